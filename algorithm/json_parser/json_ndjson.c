@@ -0,0 +1,372 @@
+/**
+ * @brief 多线程解析NDJSON(JSON Lines)文件
+ *
+ * @details
+ * 每行一个JSON对象的日志文件往往有数GB，单线程解析跑不满CPU。这里复用json_parser.c的解析器：
+ * 1. mmap整个文件，按固定大小(JSON_NDJSON_BATCH)切成批，批的边界对齐到行首：
+ *    第k批负责起点落在[k*B, (k+1)*B)内的行，不需要预先扫描整个文件
+ * 2. 固定数量的工作线程用原子计数器领取批，逐行调用parse_arena
+ * 3. 每个线程一个arena，一批解析完、回调完就arena_reset，内存只和批大小有关
+ * 4. 每行解析完回调一次，两种交付方式：
+ *    - 无序：线程解析完一行立即回调，回调会在多个线程中并发执行
+ *    - 有序：线程解析完整批后等前面的批交付完，再按行序回调，回调不会并发执行；
+ *      同时在途的批不超过线程数
+ *
+ * @note
+ * - 行内容直接指向mmap，下一行的'\n'就是parse_arena需要的哨兵；
+ *   文件最后一行没有换行时拷贝一份再解析，避免读到映射区之外
+ * - 空行(只有空白)跳过；行尾的'\r'按空白处理
+ * - 编译: gcc -O2 -pthread json_ndjson.c
+ * - 用法: ./a.out 生成示例文件并按序打印; ./a.out file.ndjson [线程数] [ordered|unordered]
+ */
+
+#define JSON_PARSER_NO_MAIN
+#include "json_parser.c"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JSON_NDJSON_BATCH (1024 * 1024)
+
+typedef struct json_line_s {
+    const char *text; // 行内容，不含换行，只在回调内有效
+    size_t len;
+    size_t offset;         // 行在文件中的偏移
+    const json_doc_t *doc; // 解析失败时为NULL
+    int thread;            // 执行回调的线程编号，0 ~ 线程数-1
+} json_line_t;
+
+// 返回非0时停止处理，json_ndjson_file返回-1
+typedef int (*json_line_fn)(void *arg, const json_line_t *line);
+
+typedef struct json_ndjson_s {
+    const char *data;
+    size_t size;
+    size_t batches;
+    int ordered;
+    json_line_fn cb;
+    void *arg;
+
+    size_t next_batch;   // 下一个待领取的批，原子操作
+    int stop;            // 回调要求停止，原子操作
+    size_t deliver;      // 有序模式下轮到交付的批
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} json_ndjson_t;
+
+typedef struct json_worker_s {
+    json_ndjson_t *job;
+    int id;
+    json_arena_t arena;
+    json_line_t *lines; // 有序模式下暂存一批的结果
+    size_t count;
+    size_t cap;
+} json_worker_t;
+
+static int is_blank(const char *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (!is_whitespace(p[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// 解析一行。最后一行没有换行时没有可读的哨兵，拷贝到arena里补'\0'
+static const json_doc_t *parse_line(json_worker_t *w, const char *text, size_t len)
+{
+    json_ndjson_t *job = w->job;
+    if (text + len == job->data + job->size) {
+        char *copy = arena_alloc(&w->arena, len + 1);
+        if (copy == NULL)
+            return NULL;
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+        text = copy;
+    }
+    return parse_arena(&w->arena, text, len);
+}
+
+static int deliver(json_worker_t *w, json_line_t *line)
+{
+    json_ndjson_t *job = w->job;
+    line->thread = w->id;
+    if (job->cb(job->arg, line) != 0) {
+        __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+static int push_line(json_worker_t *w, const json_line_t *line)
+{
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 1024;
+        json_line_t *lines = realloc(w->lines, cap * sizeof(json_line_t));
+        if (lines == NULL)
+            return -1;
+        w->lines = lines;
+        w->cap = cap;
+    }
+    w->lines[w->count++] = *line;
+    return 0;
+}
+
+// 有序模式：等前面的批都交付完，再交付本批，最后唤醒等待下一批的线程
+static void deliver_batch(json_worker_t *w, size_t batch)
+{
+    json_ndjson_t *job = w->job;
+    pthread_mutex_lock(&job->lock);
+    while (job->deliver != batch)
+        pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    for (size_t i = 0; i < w->count && !__atomic_load_n(&job->stop, __ATOMIC_RELAXED); i++) {
+        if (deliver(w, &w->lines[i]) != 0)
+            break;
+    }
+    w->count = 0;
+
+    pthread_mutex_lock(&job->lock);
+    job->deliver++;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void process_batch(json_worker_t *w, size_t batch)
+{
+    json_ndjson_t *job = w->job;
+    const char *data = job->data;
+    const char *end = data + job->size;
+    size_t first = batch * JSON_NDJSON_BATCH;
+    size_t last = first + JSON_NDJSON_BATCH < job->size ? first + JSON_NDJSON_BATCH : job->size;
+    const char *limit = data + last; // 起点在limit之前的行属于本批
+    const char *p = data + first;
+
+    // 跳过上一批的最后一行
+    if (batch > 0) {
+        p = memchr(p - 1, '\n', end - (p - 1));
+        p = p ? p + 1 : end;
+    }
+    while (p < limit && !__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t len = (nl ? nl : end) - p;
+        if (!is_blank(p, len)) {
+            json_line_t line = {p, len, (size_t)(p - data), parse_line(w, p, len), w->id};
+            if (job->ordered) {
+                if (push_line(w, &line) != 0) {
+                    __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+            } else if (deliver(w, &line) != 0) {
+                break;
+            }
+        }
+        p = nl ? nl + 1 : end;
+    }
+    if (job->ordered)
+        deliver_batch(w, batch);
+    arena_reset(&w->arena);
+}
+
+static void *worker_main(void *arg)
+{
+    json_worker_t *w = arg;
+    json_ndjson_t *job = w->job;
+    while (1) {
+        size_t batch = __atomic_fetch_add(&job->next_batch, 1, __ATOMIC_RELAXED);
+        if (batch >= job->batches)
+            break;
+        // 有序模式下即使已经停止也要走一遍交付流程，推进deliver，否则等待的线程不会醒来
+        process_batch(w, batch);
+    }
+    return NULL;
+}
+
+// threads<=0时使用全部CPU核。回调出错或要求停止时返回-1
+int json_ndjson_file(const char *path, int threads, int ordered, json_line_fn cb, void *arg)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    json_ndjson_t job = {0};
+    job.data = data;
+    job.size = st.st_size;
+    job.batches = (job.size + JSON_NDJSON_BATCH - 1) / JSON_NDJSON_BATCH;
+    job.ordered = ordered;
+    job.cb = cb;
+    job.arg = arg;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t)threads > job.batches)
+        threads = (int)job.batches;
+    json_worker_t *workers = calloc(threads, sizeof(json_worker_t));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    int started = 0;
+    if (workers && tids) {
+        for (; started < threads; started++) {
+            workers[started].job = &job;
+            workers[started].id = started;
+            if (pthread_create(&tids[started], NULL, worker_main, &workers[started]) != 0)
+                break;
+        }
+    }
+    // 一个线程都没起来时在当前线程处理
+    if (started == 0 && workers) {
+        workers[0].job = &job;
+        worker_main(&workers[0]);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    for (int i = 0; workers && i < threads; i++) {
+        arena_free(&workers[i].arena);
+        free(workers[i].lines);
+    }
+    free(workers);
+    free(tids);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+    munmap((void *)data, job.size);
+    return workers && job.stop == 0 ? 0 : -1;
+}
+
+/************************** 示例 **************************/
+
+#define MAX_THREADS 256
+
+// 按线程统计，回调里不用加锁；每个线程独占一个cache line，避免伪共享
+typedef struct thread_stats_s {
+    size_t docs;
+    size_t errors;
+    long sum;
+} __attribute__((aligned(64))) thread_stats_t;
+
+typedef struct stats_s {
+    thread_stats_t per[MAX_THREADS];
+    int print;
+    int ordered;
+    long last_id; // 有序模式下回调不并发，检查id递增
+    size_t out_of_order;
+} stats_t;
+
+static int on_line(void *arg, const json_line_t *line)
+{
+    stats_t *st = arg;
+    int t = line->thread;
+    if (line->doc == NULL) {
+        st->per[t].errors++;
+        if (st->print)
+            printf("offset %zu: parse error: %.*s\n", line->offset, (int)line->len, line->text);
+        return 0;
+    }
+    st->per[t].docs++;
+    const json_value_t *id = json_obj_get(line->doc->tape, "id", 2);
+    if (id && id->type == JSON_NUM) {
+        st->per[t].sum += id->val.num;
+        if (st->ordered) {
+            if (id->val.num <= st->last_id)
+                st->out_of_order++;
+            st->last_id = id->val.num;
+        }
+    }
+    if (st->print) {
+        printf("offset %zu: ", line->offset);
+        show(line->doc->tape);
+    }
+    return 0;
+}
+
+static int write_sample(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(fp, "{\"id\":1,\"level\":\"info\",\"msg\":\"start\"}\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "{\"id\":2,\"level\":\"error\",\"tags\":[\"db\",\"retry\"],\"code\":-5}\r\n");
+    fprintf(fp, "{\"id\":3,\"level\":\"info\",\"msg\":\"broken\"\n");
+    fprintf(fp, "{\"id\":4,\"ok\":true}");
+    fclose(fp);
+    return 0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    static stats_t st;
+    if (argc < 2) {
+        const char *path = "/tmp/json_ndjson_sample.ndjson";
+        if (write_sample(path) != 0)
+            return -1;
+        st.print = 1;
+        st.ordered = 1;
+        int ret = json_ndjson_file(path, 4, 1, on_line, &st);
+        unlink(path);
+        return ret;
+    }
+
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    int ordered = argc > 3 && strcmp(argv[3], "ordered") == 0;
+    st.ordered = ordered;
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    struct stat sb;
+    if (stat(argv[1], &sb) != 0) {
+        perror(argv[1]);
+        return -1;
+    }
+
+    double t0 = now_sec();
+    int ret = json_ndjson_file(argv[1], threads, ordered, on_line, &st);
+    double t1 = now_sec();
+
+    size_t docs = 0, errors = 0;
+    long sum = 0;
+    for (int i = 0; i < MAX_THREADS; i++) {
+        docs += st.per[i].docs;
+        errors += st.per[i].errors;
+        sum += st.per[i].sum;
+    }
+    printf("%s, %d threads: %zu docs, %zu errors, id sum %ld, %.1f MB/s\n",
+           ordered ? "ordered" : "unordered", threads, docs, errors, sum,
+           sb.st_size / (t1 - t0) / 1e6);
+    if (ordered && st.out_of_order)
+        printf("%zu docs out of order!\n", st.out_of_order);
+    return ret;
+}
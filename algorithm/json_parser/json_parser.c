@@ -1,38 +1,58 @@
 /**
- * @brief 递归下降的JSON解析器实现
+ * @brief 两阶段的JSON解析器实现
  *
  * @details
  * 核心实现原理：
- * 1. 递归下降解析(Recursive Descent Parsing)
- *    - 每种JSON语法结构都有对应的解析函数
- *    - 根据当前字符判断解析方向
- *    - 通过递归处理嵌套结构
+ * 1. 第一阶段：结构索引(Structural Indexing)
+ *    - 每次处理64字节，用SIMD(AVX2/SSE4.2，不支持时用标量代码)把每个字节分类，
+ *      得到引号、反斜杠、空白、结构字符({}[]:,)的64位掩码
+ *    - 用位运算找出被转义的引号，前缀异或得到"在字符串内"的掩码
+ *    - 输出索引：字符串外的结构字符、字符串首尾引号、标量(数字/true/false/null)起点的下标
+ *    - 整个过程没有逐字节的分支，速度接近内存带宽
  *
- * 2. 主要数据结构：
- *    - json_value_t: 使用tagged union表示不同类型的JSON值
- *    - json_obj_t:   使用链表实现的对象结构
- *    - json_array_t: 使用链表实现的数组结构
+ * 2. 第二阶段：递归下降(Recursive Descent Parsing)
+ *    - 沿着结构索引逐个token解析，不再逐字节跳过空白和扫描字符串
+ *    - 每种JSON语法结构都有对应的解析函数，通过递归处理嵌套结构
  *
- * 3. 解析过程：
- *    - 词法分析：跳过空白字符，识别基本token
- *    - 语法分析：递归构建对象/数组的树形结构
- *    - 错误处理：发现语法错误时及时返回
+ * 3. 主要数据结构：
+ *    - json_index_t: 第一阶段输出的token下标数组
+ *    - json_value_t: 使用tagged union表示不同类型的JSON值，16字节
+ *    - json_doc_t:   解析结果。所有节点按先序连续存放在一个数组(tape)里，
+ *                    容器的子节点紧跟在它后面，容器记录整棵子树的节点数，用来跳到下一个兄弟；
+ *                    对象的子节点是 键,值,键,值...；字符串统一拷贝到一块字符串缓冲区
+ *    - json_obj_index_t: 成员较多的对象在解析时额外建一张开放寻址哈希表，
+ *                    json_obj_get按键查找：小对象顺序比较，大对象O(1)
+ *    - json_arena_t: 文档的全部内存都从arena分配，json_free一次释放；
+ *                    parse_arena让多个文档共用调用方的arena，见json_ndjson.c
  *
  * @note
  * - 支持的数据类型：object, array, string, number, true, false, null
- * - number仅支持整数(long类型)
- * - 不支持浮点数和Unicode转义序列
+ * - number按RFC 8259的完整语法解析，分三种：能放进long的整数、超过long但能放进unsigned long的正整数、
+ *   其余(带小数点或指数、整数溢出)转成正确舍入的double，见"数字解析"一节
+ * - 不支持Unicode转义序列，字符串内容原样拷贝(不反转义)
+ * - SIMD实现在运行时按CPU选择，环境变量JSON_SIMD=scalar|sse42|avx2可强制指定
+ * - 解析出错时返回NULL，已分配的内存随arena一起释放
+ * - 用法: ./a.out 解析内置示例; ./a.out file.json 解析文件并输出两个阶段的吞吐
  */
 
-#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#define X64_LONG_MAX 9223372036854775807L
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_X86 1
+#endif
+
+#include "json_pow5.h"
 
 typedef enum json_type_e {
-    JSON_NUM,
+    JSON_NUM,    // long
+    JSON_UINT,   // unsigned long，只用于大于LONG_MAX的正整数
+    JSON_DOUBLE, // double
     JSON_STRING,
     JSON_TRUE,
     JSON_FALSE,
@@ -41,243 +61,960 @@ typedef enum json_type_e {
     JSON_ARRAY,
 } json_type_t;
 
-typedef struct json_value_s json_value_t;
-typedef struct json_obj_s json_obj_t;
-typedef struct json_array_s json_array_t;
+// 成员数达到这个值的对象建哈希索引，再少时顺序比较更快
+#define JSON_OBJ_INDEX_MIN 16
+
+// 对象/数组的最大嵌套层数，超过时解析失败而不是递归到栈溢出。和json_stream.c的上限一致
+#define JSON_MAX_DEPTH 512
 
-struct json_value_s {
+// 对象的哈希索引，和文档一起在arena里
+typedef struct json_obj_index_s {
+    size_t size;      // 对象整棵子树的节点数
+    uint32_t mask;    // 槽数-1，槽数是2的幂
+    uint32_t slots[]; // 键节点相对对象节点的偏移，0表示空槽
+} json_obj_index_t;
+
+// tape上的一个节点
+typedef struct json_value_s {
     json_type_t type;
+    uint32_t len; // 字符串：字节数；数组：元素个数；对象：键值对个数
     union {
-        json_obj_t *obj;
-        json_array_t *array;
         long num;
-        char *str;
+        unsigned long unum;
+        double dbl;
+        const char *str;          // 指向文档的字符串缓冲区，以'\0'结尾
+        size_t size;              // 容器：整棵子树的节点数(含自身)
+        json_obj_index_t *index;  // 成员数>=JSON_OBJ_INDEX_MIN的对象，size挪到索引里，节点保持16字节
     } val;
-};
+} json_value_t;
+
+// arena由若干内存块组成，只分配不单独释放
+typedef struct json_chunk_s {
+    struct json_chunk_s *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} json_chunk_t;
 
-struct json_obj_s {
-    char *key;
-    json_value_t value;
-    json_obj_t *next;
-};
+typedef struct json_arena_s {
+    json_chunk_t *head;
+} json_arena_t;
 
-struct json_array_s {
-    json_value_t value;
-    json_array_t *next;
-};
+typedef struct json_doc_s {
+    json_arena_t arena;
+    json_value_t *tape; // tape[0]是根节点
+    size_t count;       // 节点数
+} json_doc_t;
+
+// 第一阶段的输出：token在输入中的下标，字符串的首尾引号各占一项。
+// pos[count]是输入末尾'\0'的下标，作为哨兵
+typedef struct json_index_s {
+    uint32_t *pos;
+    size_t count;
+} json_index_t;
 
 typedef struct json_ctx_s {
-    const char *cur;
+    const char *json;
+    const uint32_t *pos; // 结构索引
+    size_t count;
+    size_t i;           // 当前token
+    json_value_t *tape; // 输出
+    size_t n;           // 已写入的节点数
+    char *strs;         // 字符串缓冲区的写入位置
+    json_arena_t *arena;
+    int depth;          // 当前嵌套层数
 } json_ctx_t;
 
-int parse_obj(json_ctx_t *ctx, json_value_t *v);
+int parse_value(json_ctx_t *ctx);
 
-int parse_value(json_ctx_t *ctx, json_value_t *v);
+/************************** 内存：arena **************************/
 
-int is_whitespace(char c)
+#define JSON_CHUNK_SIZE (64 * 1024)
+
+// 按8字节对齐分配，当前块不够时新建一块，大请求单独成块
+static void *arena_alloc(json_arena_t *a, size_t size)
 {
-    return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+    json_chunk_t *c = a->head;
+    size = (size + 7) & ~(size_t)7;
+    if (c == NULL || c->cap - c->used < size) {
+        size_t cap = size > JSON_CHUNK_SIZE ? size : JSON_CHUNK_SIZE;
+        c = malloc(sizeof(json_chunk_t) + cap);
+        if (c == NULL)
+            return NULL;
+        c->used = 0;
+        c->cap = cap;
+        c->next = a->head;
+        a->head = c;
+    }
+    void *p = c->data + c->used;
+    c->used += size;
+    return p;
 }
 
-void skip_whitespace(json_ctx_t *ctx)
+static void arena_free(json_arena_t *a)
 {
-    while (is_whitespace(*ctx->cur)) {
-        ctx->cur++;
+    json_chunk_t *c = a->head;
+    while (c) {
+        json_chunk_t *next = c->next;
+        free(c);
+        c = next;
     }
+    a->head = NULL;
 }
 
-int parse_string(json_ctx_t *ctx, char **out)
+// 清空arena以便复用，保留一个标准大小的块，其余释放
+void arena_reset(json_arena_t *a)
 {
-    ctx->cur++;
-    const char *begin = ctx->cur;
-    size_t num = 0;
-    while (*ctx->cur != '"') {
-        ctx->cur++;
-        num++;
+    json_chunk_t *keep = NULL;
+    json_chunk_t *c = a->head;
+    while (c) {
+        json_chunk_t *next = c->next;
+        if (keep == NULL && c->cap == JSON_CHUNK_SIZE) {
+            keep = c;
+            keep->used = 0;
+            keep->next = NULL;
+        } else {
+            free(c);
+        }
+        c = next;
+    }
+    a->head = keep;
+}
+
+/************************** 第一阶段：结构索引 **************************/
+
+// 一个64字节块的分类结果，第i位对应块内第i个字节
+typedef struct json_block_s {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t ws; // 空白
+    uint64_t op; // 结构字符 {}[]:,
+} json_block_t;
+
+typedef void (*json_classify_fn)(const unsigned char *p, json_block_t *b);
+
+static void classify_scalar(const unsigned char *p, json_block_t *b)
+{
+    uint64_t quote = 0, backslash = 0, ws = 0, op = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (p[i]) {
+        case '"':
+            quote |= bit;
+            break;
+        case '\\':
+            backslash |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+            ws |= bit;
+            break;
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            op |= bit;
+            break;
+        default:
+            break;
+        }
+    }
+    b->quote = quote;
+    b->backslash = backslash;
+    b->ws = ws;
+    b->op = op;
+}
+
+#ifdef JSON_X86
+// SSE4.2: pcmpistrm一条指令匹配一组字符，每次处理16字节。
+// 模式必须是立即数，用const变量在-O0下编译不过
+#define JSON_CMPISTRM_MODE (_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK)
+__attribute__((target("sse4.2"))) static void classify_sse42(const unsigned char *p,
+                                                             json_block_t *b)
+{
+    const __m128i ops = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i wss = _mm_setr_epi8(' ', '\t', '\n', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    b->quote = b->backslash = b->ws = b->op = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        int shift = 16 * i;
+        // 输入中没有'\0'(调用方保证)，隐式长度即16字节
+        b->op |= (uint64_t)(uint16_t)_mm_cvtsi128_si32(_mm_cmpistrm(ops, in, JSON_CMPISTRM_MODE)) << shift;
+        b->ws |= (uint64_t)(uint16_t)_mm_cvtsi128_si32(_mm_cmpistrm(wss, in, JSON_CMPISTRM_MODE)) << shift;
+        b->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, quote)) << shift;
+        b->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, backslash))
+                        << shift;
+    }
+}
+
+// AVX2: 每次32字节。'['|0x20 == '{', ']'|0x20 == '}'，结构字符只需4次比较
+__attribute__((target("avx2"))) static void classify_avx2(const unsigned char *p,
+                                                          json_block_t *b)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    uint32_t quote[2], backslash[2], ws[2], op[2];
+
+    for (int i = 0; i < 2; i++) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+        __m256i low = _mm256_or_si256(in, lower);
+        __m256i o = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(low, _mm256_set1_epi8('{')),
+                            _mm256_cmpeq_epi8(low, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(':')),
+                            _mm256_cmpeq_epi8(in, _mm256_set1_epi8(','))));
+        __m256i w = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('\n')),
+                            _mm256_cmpeq_epi8(in, _mm256_set1_epi8('\r'))));
+        op[i] = (uint32_t)_mm256_movemask_epi8(o);
+        ws[i] = (uint32_t)_mm256_movemask_epi8(w);
+        quote[i] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"')));
+        backslash[i] =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\')));
     }
-    char *tmp = (char *)malloc(num + 1);
-    if (tmp == NULL)
+    b->quote = quote[0] | (uint64_t)quote[1] << 32;
+    b->backslash = backslash[0] | (uint64_t)backslash[1] << 32;
+    b->ws = ws[0] | (uint64_t)ws[1] << 32;
+    b->op = op[0] | (uint64_t)op[1] << 32;
+}
+#endif
+
+static json_classify_fn pick_classifier(void)
+{
+    const char *force = getenv("JSON_SIMD");
+#ifdef JSON_X86
+    __builtin_cpu_init();
+    if (force && strcmp(force, "avx2") == 0)
+        return classify_avx2;
+    if (force && strcmp(force, "sse42") == 0)
+        return classify_sse42;
+    if (!force || strcmp(force, "scalar") != 0) {
+        if (__builtin_cpu_supports("avx2"))
+            return classify_avx2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return classify_sse42;
+    }
+#else
+    (void)force;
+#endif
+    return classify_scalar;
+}
+
+// 被转义的字符：前面有奇数个连续反斜杠。prev_escaped是上一块末尾跨过来的转义
+static uint64_t find_escaped(uint64_t backslash, uint64_t *prev_escaped)
+{
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    uint64_t follows_escape, odd_starts, sequences;
+
+    backslash &= ~*prev_escaped;
+    follows_escape = backslash << 1 | *prev_escaped;
+    // 从奇数位开始的反斜杠序列，加法进位后其末尾的下一位落在偶数位
+    odd_starts = backslash & ~even_bits & ~follows_escape;
+    *prev_escaped = __builtin_add_overflow(odd_starts, backslash, &sequences);
+    return (even_bits ^ (sequences << 1)) & follows_escape;
+}
+
+// 前缀异或：第i位 = 第0..i位的异或，引号之间(含开引号)为1
+static uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/**
+ * 第一阶段：生成结构索引。json长度为len且不含'\0'。
+ * 成功返回0，字符串未闭合或内存不足返回-1。
+ */
+// 把bits中置位的下标写到out，返回个数。每次无条件写8个，减少分支预测失败，
+// 多写的位置会被下一块覆盖，所以out末尾要预留64个空位
+static size_t flatten_bits(uint32_t *out, uint32_t base, uint64_t bits)
+{
+    size_t cnt = (size_t)__builtin_popcountll(bits);
+
+    for (size_t k = 0; k < cnt; k += 8) {
+        for (int j = 0; j < 8; j++) {
+            out[k + j] = base + (uint32_t)__builtin_ctzll(bits | (1ULL << 63));
+            bits &= bits - 1;
+        }
+    }
+    return cnt;
+}
+
+int build_index(const char *json, size_t len, json_index_t *idx)
+{
+    static json_classify_fn classify_once; // 多线程同时初始化时结果相同，用原子读写即可
+    json_classify_fn classify = __atomic_load_n(&classify_once, __ATOMIC_RELAXED);
+    uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+    unsigned char tail[64];
+    size_t n = 0;
+
+    if (classify == NULL) {
+        classify = pick_classifier();
+        __atomic_store_n(&classify_once, classify, __ATOMIC_RELAXED);
+    }
+    if (len >= UINT32_MAX)
+        return -1;
+    idx->pos = malloc((len + 64 + 2) * sizeof(uint32_t));
+    if (idx->pos == NULL)
         return -1;
-    strncpy(tmp, begin, num);
-    tmp[num] = '\0';
-    *out = tmp;
-    ctx->cur++;
+
+    for (size_t base = 0; base < len; base += 64) {
+        const unsigned char *p = (const unsigned char *)json + base;
+        json_block_t b;
+        uint64_t escaped, quote, in_string, scalar, bits;
+
+        if (len - base < 64) {
+            // 最后不足64字节的块用空格补齐
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, len - base);
+            p = tail;
+        }
+        classify(p, &b);
+
+        escaped = find_escaped(b.backslash, &prev_escaped);
+        quote = b.quote & ~escaped;
+        in_string = prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+        // 标量：字符串外既不是空白也不是结构字符的字节，只记录每段的起点
+        scalar = ~(b.op | b.ws | quote | in_string);
+        bits = (b.op & ~in_string) | quote | (scalar & ~(scalar << 1 | prev_scalar));
+        prev_scalar = scalar >> 63;
+
+        n += flatten_bits(idx->pos + n, (uint32_t)base, bits);
+    }
+    idx->count = n;
+    idx->pos[n] = (uint32_t)len;
+    if (prev_in_string) {
+        free(idx->pos);
+        idx->pos = NULL;
+        return -1;
+    }
     return 0;
 }
 
-// x64 long
-int parse_number(json_ctx_t *ctx, json_value_t *v)
+/************************** 第二阶段：沿索引解析 **************************/
+
+int is_whitespace(char c)
+{
+    return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+// 当前token的首字符，没有更多token时是哨兵指向的'\0'
+static char peek(json_ctx_t *ctx)
+{
+    return ctx->json[ctx->pos[ctx->i]];
+}
+
+static const char *token(json_ctx_t *ctx)
+{
+    return ctx->json + ctx->pos[ctx->i];
+}
+
+// 标量之后必须是空白、结构字符或输入结尾
+static int scalar_end(const char *p)
+{
+    switch (*p) {
+    case '\0':
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+    case '"':
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// 在tape末尾追加一个节点，容量在parse里按token数预留，不会越界
+static json_value_t *push(json_ctx_t *ctx, json_type_t type)
+{
+    json_value_t *v = &ctx->tape[ctx->n++];
+    v->type = type;
+    v->len = 0;
+    return v;
+}
+
+// 当前token是开引号，下一个token是对应的闭引号
+int parse_string(json_ctx_t *ctx)
 {
-    long n = 0;
-    // https://tools.ietf.org/html/rfc7159#page-6
-    if (ctx->cur[0] == '0' && ctx->cur[1] != '0' && isdigit(ctx->cur[1]))
+    if (ctx->i + 1 >= ctx->count) // 闭引号缺失(build_index已检查，这里防御)
         return -1;
+    uint32_t begin = ctx->pos[ctx->i] + 1;
+    size_t num = ctx->pos[ctx->i + 1] - begin;
+    json_value_t *v = push(ctx, JSON_STRING);
+    memcpy(ctx->strs, ctx->json + begin, num);
+    ctx->strs[num] = '\0';
+    v->len = (uint32_t)num;
+    v->val.str = ctx->strs;
+    ctx->strs += num + 1;
+    ctx->i += 2;
+    return 0;
+}
+
+/************************** 数字解析 **************************/
+// RFC 8259: number = [ "-" ] int [ frac ] [ exp ]
+//   int = "0" / ( digit1-9 *DIGIT ),  frac = "." 1*DIGIT,  exp = ( "e" / "E" ) [ "-" / "+" ] 1*DIGIT
+//
+// 数值 = 十进制尾数w * 10^q，转double的步骤：
+// 1. 数字逐段解析，8位一组用SWAR一次算完
+// 2. Clinger快速路径：w <= 2^53且|q| <= 22时，w和10^q都能精确表示成double，一次乘除就是正确舍入的结果
+// 3. Eisel-Lemire：w左移到最高位为1，乘以5^q的128位近似(json_pow5.h)，乘积的高位就是double的尾数，
+//    2的幂部分直接算出指数。近似误差只可能影响舍入时，积的低位会暴露出来，此时再乘一次表的低64位修正
+// 4. 有效数字超过19位时w只取前19位，分别按w和w+1算，两者一致就是答案；不一致(极少见)才退回strtod
+
+#define JSON_DOUBLE_MANTISSA_BITS 52
+#define JSON_DOUBLE_INFINITE_POWER 0x7FF
+
+static int is_digit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+static uint64_t load8(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// 8个字节是否都是'0'~'9'：高4位是3，且加6后不进位到高4位
+static int is_eight_digits(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// 8位数字一次算出：相邻两位合成两位数，再两两合成四位数，最后合成八位数
+static uint32_t parse_eight_digits(uint64_t v)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000 << 32)
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)v;
+}
 
-    int sign_flag = 1;
-    if (*ctx->cur == '-') {
-        sign_flag = -1;
-        ctx->cur++;
+// 解析连续的数字累加到*w(超过19位时会回绕，调用方按位数判断)，返回第一个非数字字符
+static const char *parse_digits(const char *p, const char *end, uint64_t *w)
+{
+    uint64_t v = *w;
+    while (end - p >= 8 && is_eight_digits(load8(p))) {
+        v = v * 100000000 + parse_eight_digits(load8(p));
+        p += 8;
+    }
+    while (is_digit(*p)) {
+        v = v * 10 + (uint64_t)(*p - '0');
+        p++;
     }
+    *w = v;
+    return p;
+}
+
+// double去掉符号位后的两部分：尾数(不含隐含的1)和带偏移的指数
+typedef struct json_float_s {
+    uint64_t mantissa;
+    int32_t power2;
+} json_float_t;
 
-    while (isdigit(*ctx->cur)) {
-        if (n > X64_LONG_MAX / 10)
+// w * 5^q的128位近似的高位，精度不够判断舍入时用表的低64位补一次
+static void mul_pow5(int64_t q, uint64_t w, uint64_t *hi, uint64_t *lo)
+{
+    const uint64_t *pow5 = json_pow5_128[q - JSON_POW5_MIN];
+    const uint64_t precision_mask = 0xFFFFFFFFFFFFFFFFULL >> (JSON_DOUBLE_MANTISSA_BITS + 3);
+    unsigned __int128 first = (unsigned __int128)w * pow5[0];
+    uint64_t h = (uint64_t)(first >> 64), l = (uint64_t)first;
+    if ((h & precision_mask) == precision_mask) {
+        uint64_t second_hi = (uint64_t)(((unsigned __int128)w * pow5[1]) >> 64);
+        l += second_hi;
+        if (second_hi > l)
+            h++;
+    }
+    *hi = h;
+    *lo = l;
+}
+
+// Eisel-Lemire：w * 10^q最接近的double，w != 0
+static json_float_t compute_float(int64_t q, uint64_t w)
+{
+    json_float_t f = {0, 0};
+    if (q < JSON_POW5_MIN)
+        return f; // 下溢为0
+    if (q > JSON_POW5_MAX) {
+        f.power2 = JSON_DOUBLE_INFINITE_POWER;
+        return f;
+    }
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    uint64_t hi, lo;
+    mul_pow5(q, w, &hi, &lo);
+
+    int upperbit = (int)(hi >> 63);
+    int shift = upperbit + 64 - JSON_DOUBLE_MANTISSA_BITS - 3;
+    f.mantissa = hi >> shift;
+    // floor(log2(10^q)) + 63，再减去左移量和double的指数偏移(-1023)
+    f.power2 = (int32_t)((((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023);
+    if (f.power2 <= 0) { // 非规格化数
+        if (-f.power2 + 1 >= 64) {
+            f.mantissa = 0;
+            f.power2 = 0;
+            return f;
+        }
+        f.mantissa >>= -f.power2 + 1;
+        f.mantissa += f.mantissa & 1;
+        f.mantissa >>= 1;
+        f.power2 = f.mantissa < (1ULL << JSON_DOUBLE_MANTISSA_BITS) ? 0 : 1;
+        return f;
+    }
+    // 正好在两个double中间：只有10^q的5^q部分能精确表示时(-4 <= q <= 23)才可能，按偶数舍入
+    if (lo <= 1 && q >= -4 && q <= 23 && (f.mantissa & 3) == 1 && (f.mantissa << shift) == hi)
+        f.mantissa &= ~1ULL;
+    f.mantissa += f.mantissa & 1;
+    f.mantissa >>= 1;
+    if (f.mantissa >= (2ULL << JSON_DOUBLE_MANTISSA_BITS)) { // 舍入进位
+        f.mantissa = 1ULL << JSON_DOUBLE_MANTISSA_BITS;
+        f.power2++;
+    }
+    f.mantissa &= ~(1ULL << JSON_DOUBLE_MANTISSA_BITS);
+    if (f.power2 >= JSON_DOUBLE_INFINITE_POWER) {
+        f.mantissa = 0;
+        f.power2 = JSON_DOUBLE_INFINITE_POWER;
+    }
+    return f;
+}
+
+static double make_double(int neg, json_float_t f)
+{
+    uint64_t bits = f.mantissa | ((uint64_t)f.power2 << JSON_DOUBLE_MANTISSA_BITS) |
+                    ((uint64_t)neg << 63);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// 尾数不超过19位的w * 10^q
+static double to_double(int neg, uint64_t w, int64_t q)
+{
+    static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                   1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                   1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (w <= (1ULL << 53) && q >= -22 && q <= 22) {
+        double d = (double)w;
+        d = q < 0 ? d / pow10[-q] : d * pow10[q];
+        return neg ? -d : d;
+    }
+    if (w == 0)
+        return neg ? -0.0 : 0.0;
+    return make_double(neg, compute_float(q, w));
+}
+
+int parse_number(json_ctx_t *ctx)
+{
+    const char *start = token(ctx);
+    const char *end = ctx->json + ctx->pos[ctx->count]; // 输入末尾，SWAR不能读过它
+    const char *p = start;
+    int neg = *p == '-';
+    p += neg;
+
+    const char *int_start = p;
+    uint64_t w = 0;
+    if (*p == '0') // https://tools.ietf.org/html/rfc7159#page-6 不能有前导0
+        p++;
+    else if (is_digit(*p))
+        p = parse_digits(p, end, &w);
+    else
+        return -1;
+    size_t digits = p - int_start;
+
+    int is_int = 1;
+    int64_t q = 0;
+    if (*p == '.') {
+        const char *frac_start = ++p;
+        p = parse_digits(p, end, &w);
+        if (p == frac_start)
             return -1;
-        if (n == X64_LONG_MAX / 10 && *ctx->cur - '0' > X64_LONG_MAX % 10)
+        digits += p - frac_start;
+        q = -(int64_t)(p - frac_start);
+        is_int = 0;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        int exp_neg = *p == '-';
+        if (*p == '-' || *p == '+')
+            p++;
+        if (!is_digit(*p))
             return -1;
-        n = n * 10 + (*ctx->cur) - '0';
-        ctx->cur++;
+        int64_t e = 0;
+        for (; is_digit(*p); p++) {
+            if (e < 0x10000000) // 再大都是0或inf，只需防溢出
+                e = e * 10 + (*p - '0');
+        }
+        q += exp_neg ? -e : e;
+        is_int = 0;
+    }
+    if (!scalar_end(p))
+        return -1;
+
+    // 整数：19位以内不会溢出，20位的和UINT64_MAX比较
+    if (is_int && (digits < 20 || (digits == 20 && memcmp(int_start, "18446744073709551615", 20) <= 0))) {
+        if (!neg && w <= (uint64_t)LONG_MAX) {
+            push(ctx, JSON_NUM)->val.num = (long)w;
+        } else if (!neg) {
+            push(ctx, JSON_UINT)->val.unum = w;
+        } else if (w <= (uint64_t)LONG_MAX + 1) {
+            push(ctx, JSON_NUM)->val.num = (long)(0 - w);
+        } else {
+            push(ctx, JSON_DOUBLE)->val.dbl = to_double(neg, w, 0);
+        }
+        ctx->i++;
+        return 0;
     }
-    v->type = JSON_NUM;
-    v->val.num = n * sign_flag;
+
+    double d;
+    if (digits <= 19) {
+        d = to_double(neg, w, q);
+    } else {
+        // 去掉前导0后取前19位有效数字，其余的位数计入指数
+        const char *c = int_start;
+        while (*c == '0' || *c == '.') {
+            if (*c == '0')
+                digits--;
+            c++;
+        }
+        if (digits <= 19) {
+            d = to_double(neg, w, q);
+        } else {
+            uint64_t w19 = 0;
+            for (int n = 0; n < 19; c++) {
+                if (*c != '.') {
+                    w19 = w19 * 10 + (uint64_t)(*c - '0');
+                    n++;
+                }
+            }
+            q += (int64_t)digits - 19;
+            json_float_t lo = compute_float(q, w19);
+            json_float_t hi = compute_float(q, w19 + 1);
+            if (lo.mantissa == hi.mantissa && lo.power2 == hi.power2)
+                d = make_double(neg, lo);
+            else
+                d = strtod(start, NULL);
+        }
+    }
+    push(ctx, JSON_DOUBLE)->val.dbl = d;
+    ctx->i++;
     return 0;
 }
 
-int parse_array(json_ctx_t *ctx, json_value_t *v)
+// 容器节点先占位，子节点解析完后回填个数和子树大小。
+// 用下标而不是指针记住占位节点，写法上不依赖tape不搬家
+int parse_array(json_ctx_t *ctx)
 {
-    if (*ctx->cur != '[')
+    if (peek(ctx) != '[')
         return -1;
 
-    ctx->cur++;
-    skip_whitespace(ctx);
-    if (*ctx->cur == ']')
+    size_t self = ctx->n;
+    push(ctx, JSON_ARRAY);
+    ctx->i++;
+    if (peek(ctx) == ']') {
+        ctx->i++;
+        ctx->tape[self].val.size = 1;
         return 0;
+    }
 
-    v->type = JSON_ARRAY;
+    uint32_t len = 0;
     while (1) {
-        json_array_t *a = malloc(sizeof(json_array_t));
-        if (a == NULL)
+        if (parse_value(ctx) != 0)
             return -1;
-        a->next = v->val.array;
-        v->val.array = a;
+        len++;
 
-        if (parse_value(ctx, &a->value) != 0)
-            return -1;
-        skip_whitespace(ctx);
-
-        if (*ctx->cur == ']') {
-            ctx->cur++;
-            return 0;
+        if (peek(ctx) == ']') {
+            ctx->i++;
+            break;
         }
 
-        if (*ctx->cur == ',') {
-            ctx->cur++;
+        if (peek(ctx) == ',') {
+            ctx->i++;
         } else {
             return -1;
         }
-        skip_whitespace(ctx);
     }
+    ctx->tape[self].len = len;
+    ctx->tape[self].val.size = ctx->n - self;
+    return 0;
+}
+
+// 节点及其子树占用的节点数
+static size_t json_size(const json_value_t *v)
+{
+    switch (v->type) {
+    case JSON_ARRAY:
+        return v->val.size;
+    case JSON_OBJ:
+        return v->len >= JSON_OBJ_INDEX_MIN ? v->val.index->size : v->val.size;
+    default:
+        return 1;
+    }
+}
+
+// 同一层的下一个节点，容器要跳过整棵子树
+static const json_value_t *json_next(const json_value_t *v)
+{
+    return v + json_size(v);
+}
+
+// FNV-1a
+static uint32_t json_hash(const char *key, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int key_equal(const json_value_t *k, const char *key, size_t len)
+{
+    return k->len == len && memcmp(k->val.str, key, len) == 0;
+}
+
+// 对象的成员都解析完后建索引，槽数不少于成员数的2倍。重复的键只记第一个，和顺序查找一致
+static int build_obj_index(json_ctx_t *ctx, size_t self)
+{
+    json_value_t *obj = &ctx->tape[self];
+    uint32_t cap = 1;
+    while (cap < obj->len * 2)
+        cap <<= 1;
+    json_obj_index_t *index = arena_alloc(ctx->arena, sizeof(json_obj_index_t) + cap * sizeof(uint32_t));
+    if (index == NULL)
+        return -1;
+    index->size = ctx->n - self;
+    index->mask = cap - 1;
+    memset(index->slots, 0, cap * sizeof(uint32_t));
+
+    const json_value_t *k = obj + 1;
+    for (uint32_t m = 0; m < obj->len; m++) {
+        uint32_t slot = json_hash(k->val.str, k->len) & index->mask;
+        while (index->slots[slot] && !key_equal(obj + index->slots[slot], k->val.str, k->len))
+            slot = (slot + 1) & index->mask;
+        if (index->slots[slot] == 0)
+            index->slots[slot] = (uint32_t)(k - obj);
+        k = json_next(k + 1);
+    }
+    obj->val.index = index;
+    return 0;
 }
 
-int parse_obj(json_ctx_t *ctx, json_value_t *v)
+int parse_obj(json_ctx_t *ctx)
 {
-    if (*ctx->cur != '{')
+    if (peek(ctx) != '{')
         return -1;
 
-    ctx->cur++;
-    skip_whitespace(ctx);
-    if (*ctx->cur == '}')
+    size_t self = ctx->n;
+    push(ctx, JSON_OBJ);
+    ctx->i++;
+    if (peek(ctx) == '}') {
+        ctx->i++;
+        ctx->tape[self].val.size = 1;
         return 0;
+    }
 
-    v->type = JSON_OBJ;
+    uint32_t len = 0;
     while (1) {
-        json_obj_t *m = malloc(sizeof(json_obj_t));
-        if (m == NULL)
-            return -1;
-        m->next = v->val.obj;
-        v->val.obj = m;
-
         // key
-        if (*ctx->cur == '"') {
-            parse_string(ctx, &m->key);
-        } else {
+        if (peek(ctx) != '"' || parse_string(ctx) != 0)
             return -1;
-        }
-        skip_whitespace(ctx);
 
         // colon
-        if (*ctx->cur++ != ':')
+        if (peek(ctx) != ':')
             return -1;
-        skip_whitespace(ctx);
+        ctx->i++;
 
         // value
-        if (parse_value(ctx, &m->value) == -1)
+        if (parse_value(ctx) == -1)
             return -1;
+        len++;
 
         // next element
-        skip_whitespace(ctx);
-        if (*ctx->cur == ',') {
-            ctx->cur++;
-            skip_whitespace(ctx);
-        } else if (*ctx->cur == '}') {
-            ctx->cur++;
-            return 0;
+        if (peek(ctx) == ',') {
+            ctx->i++;
+        } else if (peek(ctx) == '}') {
+            ctx->i++;
+            break;
         } else {
             return -1;
         }
     }
+    ctx->tape[self].len = len;
+    if (len >= JSON_OBJ_INDEX_MIN)
+        return build_obj_index(ctx, self);
+    ctx->tape[self].val.size = ctx->n - self;
+    return 0;
+}
+
+// 按键查找对象成员，返回值节点，没有或obj不是对象时返回NULL。
+// key不需要以'\0'结尾；键相同的成员返回第一个
+const json_value_t *json_obj_get(const json_value_t *obj, const char *key, size_t len)
+{
+    if (obj->type != JSON_OBJ)
+        return NULL;
+    if (obj->len >= JSON_OBJ_INDEX_MIN) {
+        const json_obj_index_t *index = obj->val.index;
+        uint32_t slot = json_hash(key, len) & index->mask;
+        while (index->slots[slot]) {
+            const json_value_t *k = obj + index->slots[slot];
+            if (key_equal(k, key, len))
+                return k + 1;
+            slot = (slot + 1) & index->mask;
+        }
+        return NULL;
+    }
+    const json_value_t *k = obj + 1;
+    for (uint32_t m = 0; m < obj->len; m++) {
+        if (key_equal(k, key, len))
+            return k + 1;
+        k = json_next(k + 1);
+    }
+    return NULL;
 }
 
-int parse_string_word(json_ctx_t *ctx, const char *word, json_value_t *v,
-                      json_type_t type)
+int parse_string_word(json_ctx_t *ctx, const char *word, json_type_t type)
 {
+    const char *cur = token(ctx);
     while (*word) {
-        if (*ctx->cur != *word)
+        if (*cur != *word)
             return -1;
-        ctx->cur++;
+        cur++;
         word++;
     }
-    v->type = type;
+    if (!scalar_end(cur))
+        return -1;
+    push(ctx, type);
+    ctx->i++;
     return 0;
 }
 
-int parse_value(json_ctx_t *ctx, json_value_t *v)
+// 容器递归前检查层数
+static int parse_nested(json_ctx_t *ctx, int (*parse_container)(json_ctx_t *))
 {
-    switch (*ctx->cur) {
+    if (ctx->depth == JSON_MAX_DEPTH)
+        return -1;
+    ctx->depth++;
+    int ret = parse_container(ctx);
+    ctx->depth--;
+    return ret;
+}
+
+int parse_value(json_ctx_t *ctx)
+{
+    switch (peek(ctx)) {
     case '"':
-        v->type = JSON_STRING;
-        return parse_string(ctx, &v->val.str);
+        return parse_string(ctx);
     case '{':
-        v->type = JSON_OBJ;
-        v->val.obj = NULL;
-        return parse_obj(ctx, v);
+        return parse_nested(ctx, parse_obj);
     case 't':
-        v->type = JSON_TRUE;
-        return parse_string_word(ctx, "true", v, JSON_TRUE);
+        return parse_string_word(ctx, "true", JSON_TRUE);
     case 'f':
-        v->type = JSON_FALSE;
-        return parse_string_word(ctx, "false", v, JSON_FALSE);
+        return parse_string_word(ctx, "false", JSON_FALSE);
     case 'n':
-        v->type = JSON_NULL;
-        return parse_string_word(ctx, "null", v, JSON_NULL);
+        return parse_string_word(ctx, "null", JSON_NULL);
     case '[':
-        v->type = JSON_ARRAY;
-        v->val.array = NULL;
-        return parse_array(ctx, v);
+        return parse_nested(ctx, parse_array);
+    case '\0':
+        return -1;
     default:
-        return parse_number(ctx, v);
+        return parse_number(ctx);
     }
 }
 
-json_value_t *parse(const char *json)
+void json_free(json_doc_t *doc)
+{
+    if (doc == NULL)
+        return;
+    json_arena_t arena = doc->arena; // doc本身也在arena里
+    arena_free(&arena);
+}
+
+// 文档从调用方的arena分配，随arena一起释放，不要调用json_free。失败返回NULL，
+// 已分配的部分也留在arena里。json不需要以'\0'结尾，但json[len]必须可读，且是'\0'或空白(哨兵)
+json_doc_t *parse_arena(json_arena_t *arena, const char *json, size_t len)
 {
+    json_index_t idx;
     json_ctx_t ctx;
-    ctx.cur = json;
-    skip_whitespace(&ctx);
-    if (*ctx.cur != '{') // first must an object
+    json_doc_t *doc = NULL;
+    if (build_index(json, len, &idx) != 0)
         return NULL;
-    json_value_t *v = malloc(sizeof(json_value_t));
-    if (v == NULL)
+    ctx.json = json;
+    ctx.pos = idx.pos;
+    ctx.count = idx.count;
+    ctx.i = 0;
+    if (peek(&ctx) != '{') // first must an object
+        goto fail;
+
+    // 每个节点至少消耗一个token，字符串内容不会超过输入长度，每个字符串再加一个'\0'
+    doc = arena_alloc(arena, sizeof(json_doc_t));
+    ctx.tape = arena_alloc(arena, idx.count * sizeof(json_value_t));
+    ctx.strs = arena_alloc(arena, len + idx.count / 2 + 1);
+    if (doc == NULL || ctx.tape == NULL || ctx.strs == NULL)
+        goto fail;
+    ctx.n = 0;
+    ctx.arena = arena;
+    ctx.depth = 0;
+
+    if (parse_value(&ctx) != 0 || ctx.i != ctx.count) // 根对象之后不能还有内容
+        goto fail;
+    free(idx.pos);
+    doc->arena.head = NULL;
+    doc->tape = ctx.tape;
+    doc->count = ctx.n;
+    return doc;
+
+fail:
+    free(idx.pos);
+    return NULL;
+}
+
+// 文档独占一个arena，用json_free释放。失败返回NULL，不需要调用json_free
+json_doc_t *parse(const char *json)
+{
+    json_arena_t arena = {NULL};
+    json_doc_t *doc = parse_arena(&arena, json, strlen(json));
+    if (doc == NULL) {
+        arena_free(&arena);
         return NULL;
-    int ret = parse_value(&ctx, v);
-    if (ret != 0) {
-        printf("parse ret %d\n", ret);
-        // TODO: free memory
     }
-    return v;
+    doc->arena = arena;
+    return doc;
 }
 
-void show(json_value_t *value)
+void show(const json_value_t *value)
 {
+    const json_value_t *child = value + 1; // 容器的第一个子节点
     switch (value->type) {
     case JSON_STRING:
         printf("[str]%s\n", value->val.str);
@@ -285,24 +1022,28 @@ void show(json_value_t *value)
     case JSON_NUM:
         printf("[num]%ld\n", value->val.num);
         break;
+    case JSON_UINT:
+        printf("[uint]%lu\n", value->val.unum);
+        break;
+    case JSON_DOUBLE:
+        printf("[double]%.17g\n", value->val.dbl);
+        break;
     case JSON_OBJ:
         printf("[obj]-----start\n");
-        json_obj_t *head = value->val.obj;
-        while (head) {
-            printf("[key]%s:\t", head->key);
+        for (uint32_t k = 0; k < value->len; k++) {
+            printf("[key]%s:\t", child->val.str);
             printf("[value]");
-            show(&head->value);
-            head = head->next;
+            show(child + 1);
+            child = json_next(child + 1);
         }
         printf("[obj]-----end\n");
         break;
     case JSON_ARRAY:
         printf("[array]-----start\n");
-        json_array_t *arr = value->val.array;
-        while (arr) {
+        for (uint32_t k = 0; k < value->len; k++) {
             printf("[value]");
-            show(&arr->value);
-            arr = arr->next;
+            show(child);
+            child = json_next(child);
         }
         printf("[array]-----end\n");
         break;
@@ -320,18 +1061,82 @@ void show(json_value_t *value)
     }
 }
 
-int main()
+// 其他文件#include本文件复用解析器时定义JSON_PARSER_NO_MAIN，去掉下面的示例代码
+#ifndef JSON_PARSER_NO_MAIN
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 读入整个文件，分别测第一阶段和完整解析的吞吐
+static int bench_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *json = malloc(size + 1);
+    if (json == NULL || fread(json, 1, size, fp) != (size_t)size) {
+        fclose(fp);
+        free(json);
+        return -1;
+    }
+    fclose(fp);
+    json[size] = '\0';
+
+    json_index_t idx;
+    double t0 = now_sec();
+    if (build_index(json, size, &idx) != 0) {
+        printf("index error!\n");
+        free(json);
+        return -1;
+    }
+    double t1 = now_sec();
+    json_doc_t *doc = parse(json);
+    double t2 = now_sec();
+    size_t nodes = doc ? doc->count : 0;
+    json_free(doc);
+    double t3 = now_sec();
+    printf("%ld bytes, %zu tokens, %zu nodes\n", size, idx.count, nodes);
+    printf("stage 1 (index): %.1f MB/s\n", size / (t1 - t0) / 1e6);
+    printf("full parse:      %.1f MB/s%s\n", size / (t2 - t1) / 1e6,
+           doc ? "" : " (parse error)");
+    printf("free:            %.3f ms\n", (t3 - t2) * 1e3);
+    free(idx.pos);
+    free(json);
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
+    if (argc > 1)
+        return bench_file(argv[1]);
+
     char *json = "{\"hi\":[1,\"hi\",{\"hello\":22}],\n"
                  "\"isNull  \":null,\n"
                  "\"isTrue\":  true,\n"
                  "\"hello2\":-2,\n"
                  "\"arr2\":[\"hi\",3]}";
-    json_value_t *value = parse(json);
-    if (value == NULL) {
+    json_doc_t *doc = parse(json);
+    if (doc == NULL) {
         printf("parse error!\n");
         return -1;
     }
-    show(value);
+    show(doc->tape);
+
+    const json_value_t *v = json_obj_get(doc->tape, "hello2", strlen("hello2"));
+    printf("get hello2: ");
+    if (v)
+        show(v);
+    else
+        printf("not found\n");
+    json_free(doc);
     return 0;
 }
+#endif
@@ -0,0 +1,616 @@
+/**
+ * @brief 可续传的流式JSON解析器(SAX风格的push parser)
+ *
+ * @details
+ * json_parser.c要求整个文档一次性在内存里，这里的解析器接受任意切分的字节块，
+ * 比如socket每次read到的数据、network/stream/stream.c中RingBuffer的连续区间，
+ * 边收边解析，每解析出一个元素回调一次事件，不建树。
+ *
+ * 核心实现原理：
+ * 1. 状态机：记录"下一个期望什么"(值、键、冒号、逗号或结束括号)，
+ *    以及当前未完成的token(字符串、数字、true/false/null)，数据块在任何字节处断开都能接着解析
+ * 2. 嵌套：用一个固定大小的栈记录每层是对象还是数组，深度上限JSON_STREAM_MAX_DEPTH
+ * 3. token：完整落在一个数据块里的token直接指向数据块，不拷贝；
+ *    跨块的token先拷贝到内部缓冲区，缓冲区不超过初始化时给的上限
+ * 4. 字符串用memchr找引号和反斜杠，不逐字节判断
+ *
+ * 内存占用与文档大小无关：一个状态机 + 深度栈 + 最长token的缓冲区，
+ * 数GB的大数组也只占用这些内存。
+ *
+ * @note
+ * - number按RFC 8259的完整语法校验，和json_parser.c一样分成long/unsigned long/double三种事件，
+ *   事件里同时给出数字原文；字符串内容原样给出(不反转义)
+ * - 根必须是对象或数组，之后只能有空白
+ * - 用法: ./a.out 用随机大小的块解析内置示例并打印事件;
+ *         ./a.out file.json [块大小] 流式读取文件(-表示标准输入)并输出吞吐
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JSON_STREAM_MAX_DEPTH 512
+
+typedef enum json_event_type_e {
+    JSON_EV_OBJ_BEGIN,
+    JSON_EV_OBJ_END,
+    JSON_EV_ARRAY_BEGIN,
+    JSON_EV_ARRAY_END,
+    JSON_EV_KEY,
+    JSON_EV_STRING,
+    JSON_EV_NUM,    // long
+    JSON_EV_UINT,   // unsigned long，只用于大于LONG_MAX的正整数
+    JSON_EV_DOUBLE, // 小数、指数和超出整数范围的数
+    JSON_EV_TRUE,
+    JSON_EV_FALSE,
+    JSON_EV_NULL,
+} json_event_type_t;
+
+typedef struct json_event_s {
+    json_event_type_t type;
+    const char *str; // KEY/STRING: 引号内的原始内容；数字：原文。不以'\0'结尾，只在回调内有效
+    size_t len;
+    union {
+        long num;           // NUM
+        unsigned long unum; // UINT
+        double dbl;         // DOUBLE
+    };
+} json_event_t;
+
+// 返回非0时停止解析，json_stream_feed返回-1
+typedef int (*json_event_fn)(void *arg, const json_event_t *ev);
+
+// 期望的下一个语法元素
+typedef enum json_expect_e {
+    EXPECT_ROOT,          // 根：对象或数组
+    EXPECT_VALUE,         // ':'或数组中','之后
+    EXPECT_VALUE_OR_END,  // '['之后
+    EXPECT_KEY,           // 对象中','之后
+    EXPECT_KEY_OR_END,    // '{'之后
+    EXPECT_COLON,         // 键之后
+    EXPECT_COMMA_OR_END,  // 值之后
+    EXPECT_EOF,           // 根结束之后
+} json_expect_t;
+
+// 未完成的token
+typedef enum json_token_e {
+    TOKEN_NONE,
+    TOKEN_STRING,
+    TOKEN_KEY,
+    TOKEN_SCALAR, // 数字或true/false/null，遇到分隔符才知道结束
+} json_token_t;
+
+typedef struct json_stream_s {
+    json_event_fn cb;
+    void *arg;
+    json_expect_t expect;
+    json_token_t token;
+    int escape; // 上一块以字符串内的反斜杠结尾，下一块第一个字节被转义
+    size_t depth;
+    char stack[JSON_STREAM_MAX_DEPTH]; // 每层的开括号 '{' 或 '['
+
+    // 跨块token的缓冲区
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t max;
+
+    size_t offset; // 已处理的字节数，出错时指向出错的字节
+    const char *error;
+} json_stream_t;
+
+// max_token: 单个跨块token(字符串、数字)的最大长度
+void json_stream_init(json_stream_t *s, json_event_fn cb, void *arg, size_t max_token)
+{
+    memset(s, 0, sizeof(*s));
+    s->cb = cb;
+    s->arg = arg;
+    s->expect = EXPECT_ROOT;
+    s->max = max_token;
+}
+
+void json_stream_free(json_stream_t *s)
+{
+    free(s->buf);
+    s->buf = NULL;
+    s->cap = s->len = 0;
+}
+
+static int fail(json_stream_t *s, const char *msg)
+{
+    if (s->error == NULL)
+        s->error = msg;
+    return -1;
+}
+
+static int emit_event(json_stream_t *s, const json_event_t *ev)
+{
+    if (s->cb(s->arg, ev) != 0)
+        return fail(s, "aborted by callback");
+    return 0;
+}
+
+static int emit(json_stream_t *s, json_event_type_t type, const char *str, size_t len)
+{
+    json_event_t ev = {.type = type, .str = str, .len = len};
+    return emit_event(s, &ev);
+}
+
+// 把token的一段追加到缓冲区，容量按倍数增长到上限
+static int append(json_stream_t *s, const char *p, size_t n)
+{
+    if (s->len + n > s->max)
+        return fail(s, "token too long");
+    if (s->len + n > s->cap) {
+        size_t cap = s->cap ? s->cap : 256;
+        while (cap < s->len + n)
+            cap *= 2;
+        if (cap > s->max)
+            cap = s->max;
+        char *buf = realloc(s->buf, cap);
+        if (buf == NULL)
+            return fail(s, "out of memory");
+        s->buf = buf;
+        s->cap = cap;
+    }
+    memcpy(s->buf + s->len, p, n);
+    s->len += n;
+    return 0;
+}
+
+// 与json_parser.c的scalar_end一致：空白、结构字符、引号结束一个标量
+static int is_delim(char c)
+{
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+    case '"':
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// 一个值结束后回到所在容器
+static void end_value(json_stream_t *s)
+{
+    s->expect = s->depth ? EXPECT_COMMA_OR_END : EXPECT_EOF;
+}
+
+static const char *skip_digits(const char *cur, const char *end)
+{
+    while (cur < end && isdigit((unsigned char)*cur))
+        cur++;
+    return cur;
+}
+
+// https://tools.ietf.org/html/rfc8259#section-6
+// number = [ minus ] int [ frac ] [ exp ]，int不能有前导0
+static int parse_number(json_stream_t *s, const char *p, size_t n)
+{
+    const char *cur = p, *end = p + n;
+    int neg = cur < end && *cur == '-';
+    cur += neg;
+    if (cur == end || !isdigit((unsigned char)*cur))
+        return fail(s, "bad number");
+    if (*cur == '0' && cur + 1 < end && isdigit((unsigned char)cur[1]))
+        return fail(s, "leading zero");
+
+    unsigned long w = 0;
+    int is_int = 1; // 没有小数和指数，并且绝对值放得下unsigned long
+    for (; cur < end && isdigit((unsigned char)*cur); cur++) {
+        unsigned long d = *cur - '0';
+        if (w > (ULONG_MAX - d) / 10)
+            is_int = 0;
+        w = w * 10 + d;
+    }
+    if (cur < end && *cur == '.') {
+        const char *frac = ++cur;
+        cur = skip_digits(cur, end);
+        if (cur == frac)
+            return fail(s, "bad number");
+        is_int = 0;
+    }
+    if (cur < end && (*cur == 'e' || *cur == 'E')) {
+        cur++;
+        if (cur < end && (*cur == '+' || *cur == '-'))
+            cur++;
+        const char *exp = cur;
+        cur = skip_digits(cur, end);
+        if (cur == exp)
+            return fail(s, "bad number");
+        is_int = 0;
+    }
+    if (cur != end)
+        return fail(s, "bad number");
+
+    // 分类规则和json_parser.c的parse_number相同
+    json_event_t ev = {.type = JSON_EV_NUM, .str = p, .len = n};
+    if (is_int && !neg && w <= (unsigned long)LONG_MAX) {
+        ev.num = (long)w;
+    } else if (is_int && !neg) {
+        ev.type = JSON_EV_UINT;
+        ev.unum = w;
+    } else if (is_int && w <= (unsigned long)LONG_MAX + 1) {
+        ev.num = (long)(0 - w);
+    } else {
+        // token不以'\0'结尾，strtod需要一份拷贝；常见长度用栈上的缓冲区
+        char tmp[64];
+        char *str = n < sizeof(tmp) ? tmp : malloc(n + 1);
+        if (str == NULL)
+            return fail(s, "out of memory");
+        memcpy(str, p, n);
+        str[n] = '\0';
+        ev.type = JSON_EV_DOUBLE;
+        ev.dbl = strtod(str, NULL);
+        if (str != tmp)
+            free(str);
+    }
+    return emit_event(s, &ev);
+}
+
+static int finish_scalar(json_stream_t *s, const char *p, size_t n)
+{
+    s->token = TOKEN_NONE;
+    end_value(s);
+    if (n == 4 && memcmp(p, "true", 4) == 0)
+        return emit(s, JSON_EV_TRUE, NULL, 0);
+    if (n == 5 && memcmp(p, "false", 5) == 0)
+        return emit(s, JSON_EV_FALSE, NULL, 0);
+    if (n == 4 && memcmp(p, "null", 4) == 0)
+        return emit(s, JSON_EV_NULL, NULL, 0);
+    return parse_number(s, p, n);
+}
+
+static int finish_string(json_stream_t *s, const char *p, size_t n)
+{
+    int key = s->token == TOKEN_KEY;
+    s->token = TOKEN_NONE;
+    if (key) {
+        s->expect = EXPECT_COLON;
+        return emit(s, JSON_EV_KEY, p, n);
+    }
+    end_value(s);
+    return emit(s, JSON_EV_STRING, p, n);
+}
+
+// 在data[i, len)中找字符串的闭引号，返回它的下标，没找到返回len。
+// 每个引号之前检查有没有反斜杠，quote缓存下一个引号的位置，避免重复扫描
+static size_t scan_string(json_stream_t *s, const char *data, size_t i, size_t len)
+{
+    const char *quote = NULL;
+    if (s->escape) {
+        s->escape = 0;
+        i++;
+    }
+    while (i < len) {
+        if (quote == NULL || quote < data + i) {
+            quote = memchr(data + i, '"', len - i);
+            if (quote == NULL)
+                quote = data + len;
+        }
+        const char *bs = memchr(data + i, '\\', quote - (data + i));
+        if (bs == NULL)
+            return quote - data;
+        i = bs - data + 2; // 跳过反斜杠和被转义的字符
+        if (i > len) {
+            s->escape = 1;
+            return len;
+        }
+    }
+    return len;
+}
+
+static int open_container(json_stream_t *s, char c)
+{
+    if (s->depth == JSON_STREAM_MAX_DEPTH)
+        return fail(s, "nesting too deep");
+    s->stack[s->depth++] = c;
+    if (c == '{') {
+        s->expect = EXPECT_KEY_OR_END;
+        return emit(s, JSON_EV_OBJ_BEGIN, NULL, 0);
+    }
+    s->expect = EXPECT_VALUE_OR_END;
+    return emit(s, JSON_EV_ARRAY_BEGIN, NULL, 0);
+}
+
+static int close_container(json_stream_t *s, char c)
+{
+    char open = c == '}' ? '{' : '[';
+    if (s->depth == 0 || s->stack[s->depth - 1] != open)
+        return fail(s, "mismatched bracket");
+    s->depth--;
+    end_value(s);
+    return emit(s, c == '}' ? JSON_EV_OBJ_END : JSON_EV_ARRAY_END, NULL, 0);
+}
+
+// 值的第一个字节。标量不消耗这个字节，由标量扫描统一处理
+static int begin_value(json_stream_t *s, char c, size_t *i)
+{
+    switch (c) {
+    case '{':
+    case '[':
+        (*i)++;
+        return open_container(s, c);
+    case '"':
+        (*i)++;
+        s->token = TOKEN_STRING;
+        return 0;
+    default:
+        if (is_delim(c))
+            return fail(s, "expect value");
+        s->token = TOKEN_SCALAR;
+        return 0;
+    }
+}
+
+// 一个结构字符或值的开始
+static int step(json_stream_t *s, char c, size_t *i)
+{
+    switch (s->expect) {
+    case EXPECT_ROOT:
+        if (c != '{' && c != '[')
+            return fail(s, "root must be an object or array");
+        (*i)++;
+        return open_container(s, c);
+    case EXPECT_VALUE_OR_END:
+        if (c == ']') {
+            (*i)++;
+            return close_container(s, c);
+        }
+        return begin_value(s, c, i);
+    case EXPECT_VALUE:
+        return begin_value(s, c, i);
+    case EXPECT_KEY_OR_END:
+        if (c == '}') {
+            (*i)++;
+            return close_container(s, c);
+        }
+        // fall through
+    case EXPECT_KEY:
+        if (c != '"')
+            return fail(s, "expect key");
+        (*i)++;
+        s->token = TOKEN_KEY;
+        return 0;
+    case EXPECT_COLON:
+        if (c != ':')
+            return fail(s, "expect ':'");
+        (*i)++;
+        s->expect = EXPECT_VALUE;
+        return 0;
+    case EXPECT_COMMA_OR_END:
+        (*i)++;
+        if (c == ',') {
+            s->expect = s->stack[s->depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+            return 0;
+        }
+        if (c == '}' || c == ']')
+            return close_container(s, c);
+        (*i)--;
+        return fail(s, "expect ',' or end of container");
+    default:
+        return fail(s, "trailing data");
+    }
+}
+
+// 解析一块数据，数据可以在任意位置断开。出错返回-1，之后不能再调用
+int json_stream_feed(json_stream_t *s, const char *data, size_t len)
+{
+    size_t i = 0;
+    if (s->error)
+        return -1;
+
+    while (i < len) {
+        size_t start = i;
+        int ret = 0;
+        switch (s->token) {
+        case TOKEN_STRING:
+        case TOKEN_KEY:
+            i = scan_string(s, data, i, len);
+            if (i == len) {
+                ret = append(s, data + start, len - start);
+                break;
+            }
+            if (s->len == 0) { // 整个字符串都在这一块里
+                ret = finish_string(s, data + start, i - start);
+            } else {
+                ret = append(s, data + start, i - start);
+                if (ret == 0)
+                    ret = finish_string(s, s->buf, s->len);
+                s->len = 0;
+            }
+            i++; // 闭引号
+            break;
+        case TOKEN_SCALAR:
+            while (i < len && !is_delim(data[i]))
+                i++;
+            if (i == len) {
+                ret = append(s, data + start, len - start);
+                break;
+            }
+            if (s->len == 0) {
+                ret = finish_scalar(s, data + start, i - start);
+            } else {
+                ret = append(s, data + start, i - start);
+                if (ret == 0)
+                    ret = finish_scalar(s, s->buf, s->len);
+                s->len = 0;
+            }
+            break;
+        default:
+            if (data[i] == ' ' || data[i] == '\t' || data[i] == '\n' || data[i] == '\r') {
+                i++;
+                break;
+            }
+            ret = step(s, data[i], &i);
+            break;
+        }
+        if (ret != 0) {
+            s->offset += i;
+            return -1;
+        }
+    }
+    s->offset += len;
+    return 0;
+}
+
+// 输入结束。输入末尾的数字要到这里才知道已经完整
+int json_stream_finish(json_stream_t *s)
+{
+    if (s->error)
+        return -1;
+    if (s->token == TOKEN_SCALAR) {
+        int ret = finish_scalar(s, s->buf, s->len);
+        s->len = 0;
+        if (ret != 0)
+            return -1;
+    }
+    if (s->token != TOKEN_NONE || s->expect != EXPECT_EOF)
+        return fail(s, "unexpected end of input");
+    return 0;
+}
+
+static int print_event(void *arg, const json_event_t *ev)
+{
+    int *indent = arg;
+    if (ev->type == JSON_EV_OBJ_END || ev->type == JSON_EV_ARRAY_END)
+        (*indent)--;
+    printf("%*s", *indent * 2, "");
+    switch (ev->type) {
+    case JSON_EV_OBJ_BEGIN:
+        printf("[obj]-----start\n");
+        (*indent)++;
+        break;
+    case JSON_EV_OBJ_END:
+        printf("[obj]-----end\n");
+        break;
+    case JSON_EV_ARRAY_BEGIN:
+        printf("[array]-----start\n");
+        (*indent)++;
+        break;
+    case JSON_EV_ARRAY_END:
+        printf("[array]-----end\n");
+        break;
+    case JSON_EV_KEY:
+        printf("[key]%.*s\n", (int)ev->len, ev->str);
+        break;
+    case JSON_EV_STRING:
+        printf("[str]%.*s\n", (int)ev->len, ev->str);
+        break;
+    case JSON_EV_NUM:
+        printf("[num]%ld\n", ev->num);
+        break;
+    case JSON_EV_UINT:
+        printf("[uint]%lu\n", ev->unum);
+        break;
+    case JSON_EV_DOUBLE:
+        printf("[double]%.17g\n", ev->dbl);
+        break;
+    case JSON_EV_TRUE:
+        printf("true\n");
+        break;
+    case JSON_EV_FALSE:
+        printf("false\n");
+        break;
+    case JSON_EV_NULL:
+        printf("null\n");
+        break;
+    }
+    return 0;
+}
+
+static int count_event(void *arg, const json_event_t *ev)
+{
+    (void)ev;
+    (*(size_t *)arg)++;
+    return 0;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 像读socket一样按块read文件，内存占用只有一个块加解析器状态
+static int stream_file(const char *path, size_t chunk)
+{
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    char *buf = malloc(chunk);
+    size_t events = 0, total = 0;
+    json_stream_t s;
+    json_stream_init(&s, count_event, &events, 1 << 20);
+
+    int ret = 0;
+    double t0 = now_sec();
+    ssize_t n;
+    while ((n = read(fd, buf, chunk)) > 0) {
+        total += n;
+        if ((ret = json_stream_feed(&s, buf, n)) != 0)
+            break;
+    }
+    if (ret == 0)
+        ret = json_stream_finish(&s);
+    double t1 = now_sec();
+    if (ret != 0)
+        printf("error at byte %zu: %s\n", s.offset, s.error);
+    printf("%zu bytes, %zu events, %zu byte chunks: %.1f MB/s, token buffer %zu bytes\n", total,
+           events, chunk, total / (t1 - t0) / 1e6, s.cap);
+    json_stream_free(&s);
+    free(buf);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        return stream_file(argv[1], argc > 2 ? (size_t)atol(argv[2]) : 64 * 1024);
+
+    const char *json = "{\"hi\":[1,\"hi\",{\"hello\":22}],\n"
+                       "\"isNull  \":null,\n"
+                       "\"isTrue\":  true,\n"
+                       "\"esc\\\"aped\":\"a\\\\\",\n"
+                       "\"hello2\":-2,\n"
+                       "\"pi\":3.14159e0,\n"
+                       "\"arr2\":[\"hi\",3]}";
+    size_t len = strlen(json);
+    int indent = 0;
+    json_stream_t s;
+    json_stream_init(&s, print_event, &indent, 64);
+
+    // 模拟网络收包：每次随机1~8字节
+    srand(time(NULL));
+    for (size_t i = 0; i < len;) {
+        size_t n = 1 + rand() % 8;
+        if (n > len - i)
+            n = len - i;
+        if (json_stream_feed(&s, json + i, n) != 0)
+            break;
+        i += n;
+    }
+    if (json_stream_finish(&s) != 0)
+        printf("parse error at byte %zu: %s\n", s.offset, s.error);
+    json_stream_free(&s);
+    return 0;
+}
@@ -1,8 +1,29 @@
 // Simplified PV emulator
 
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 // Opcodes
@@ -28,116 +49,1091 @@ public:
     virtual void Write32(uint32_t addr, uint32_t value) = 0;
 };
 
-// Simple vector-backed memory implementation
-class Memory : public IMemory {
+// Notified when a page that holds decoded instructions is written.
+class ICodeObserver {
+public:
+    virtual ~ICodeObserver() = default;
+    virtual void InvalidateCode(uint32_t page) = 0;
+    // End of a concurrent quantum: re-check code decoded while other CPUs were running.
+    virtual void RevalidateCode() {}
+};
+
+// A memory-mapped peripheral: 32-bit registers at offsets inside its window.
+class IDevice {
+public:
+    virtual ~IDevice() = default;
+    virtual uint32_t ReadReg(uint32_t offset) = 0;
+    virtual void WriteReg(uint32_t offset, uint32_t value) = 0;
+};
+
+// MmioMap: page-granular (4 KiB) address decoder for device windows. A two-level table over the
+// 32-bit address space resolves any address in two indexed loads, however many devices exist.
+class MmioMap {
 public:
-    explicit Memory(uint32_t size) : size_(size), data_(size, 0) {}
+    static constexpr uint32_t kPageShift = 12;
+
+    struct Slot {
+        IDevice* device = nullptr;
+        uint32_t base = 0;  // start of the device window
+    };
+
+    // Map [base, base + size) to device. base and size are rounded out to whole pages.
+    void Map(uint32_t base, uint32_t size, IDevice* device) {
+        uint32_t first = base >> kPageShift;
+        uint32_t last = static_cast<uint32_t>((uint64_t{base} + size - 1) >> kPageShift);
+        for (uint32_t page = first; page <= last; ++page) {
+            auto& leaf = table_[page >> kLeafBits];
+            if (!leaf) leaf = std::make_unique<Leaf>();
+            (*leaf)[page & (kLeafSize - 1)] = Slot{device, base};
+        }
+    }
+
+    const Slot* Find(uint32_t addr) const {
+        uint32_t page = addr >> kPageShift;
+        const auto& leaf = table_[page >> kLeafBits];
+        if (!leaf) return nullptr;
+        const Slot& slot = (*leaf)[page & (kLeafSize - 1)];
+        return slot.device ? &slot : nullptr;
+    }
+
+private:
+    static constexpr uint32_t kLeafBits = 10;
+    static constexpr uint32_t kLeafSize = 1u << kLeafBits;
+    using Leaf = std::array<Slot, kLeafSize>;
+
+    std::array<std::unique_ptr<Leaf>, (1u << (32 - kPageShift - kLeafBits))> table_;
+};
+
+// Read-only program image shared by any number of Memory instances.
+using MemoryImage = std::shared_ptr<const std::vector<uint8_t>>;
+
+// Paged memory implementation. final so that a CPU instantiated over Memory calls these
+// directly and the compiler can inline them to plain array accesses.
+//
+// Each 4 KiB page is read through read_pages_. Pages backed by a shared MemoryImage have no
+// write pointer until the first write copies them (copy-on-write), so many emulators can start
+// from one image and only pay for the pages they modify.
+//
+// Checkpoint() starts dirty tracking: it drops every page's write pointer, so the first write
+// to a page afterwards takes the slow path, which saves the page's pre-image and lists it as
+// dirty. Restore() copies back only the dirty pages.
+//
+// Private pages are carved out of one contiguous allocation at their guest offsets. Once no
+// page is shared any more (always, without an image), reads index that flat block directly,
+// and so do writes until dirty tracking starts; the page tables are only used otherwise.
+//
+// Addresses at or above size() go to the devices attached with MapDevice(); RAM accesses only
+// pay the existing bounds check. Unmapped addresses still read as 0 and ignore writes.
+//
+// Memory also tracks which 64-byte pages hold decoded code and tells the registered observers
+// (the CPUs' decode caches) when such a page is written.
+class Memory final : public IMemory {
+public:
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint32_t kPageSize = 1u << kPageShift;
+    static constexpr uint32_t kCodePageShift = 6;  // 64-byte pages
+
+    explicit Memory(uint32_t size) : Memory(size, nullptr) {}
+
+    Memory(uint32_t size, MemoryImage image)
+        : size_(size),
+          image_(std::move(image)),
+          read_pages_((size + kPageSize - 1) >> kPageShift, nullptr),
+          write_pages_(read_pages_.size(), nullptr),
+          // calloc: pages that stay shared are never touched, so the OS never backs them.
+          ram_(static_cast<uint8_t*>(std::calloc(std::max<size_t>(read_pages_.size(), 1),
+                                                 kPageSize))),
+          owned_(read_pages_.size(), 0),
+          shared_count_(static_cast<uint32_t>(read_pages_.size())),
+          undo_pages_(read_pages_.size()),
+          undo_valid_(read_pages_.size(), 0),
+          page_is_code_(std::make_unique<std::atomic<uint8_t>[]>((size >> kCodePageShift) + 1)) {
+        if (!ram_) throw std::bad_alloc();
+        for (uint32_t page = 0; page < read_pages_.size(); ++page) {
+            if (image_ && (page + 1) * uint64_t{kPageSize} <= image_->size()) {
+                read_pages_[page] = image_->data() + (page << kPageShift);
+            } else {
+                CopyOnWrite(page);  // private page; a partial image tail is copied in
+            }
+        }
+    }
+
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
 
     uint8_t ReadByte(uint32_t addr) override {
-        if (addr >= size_) return 0;
-        return data_[addr];
+        if (addr >= size_) return static_cast<uint8_t>(ReadIo(addr & ~3u) >> (8 * (addr & 3)));
+        if (flat_read_) return flat_read_[addr];
+        return read_pages_[addr >> kPageShift][addr & (kPageSize - 1)];
     }
 
+    // Byte writes to a device store the zero-extended byte into the containing register.
     void WriteByte(uint32_t addr, uint8_t value) override {
-        if (addr >= size_) return;
-        data_[addr] = value;
+        if (addr >= size_) return WriteIo(addr & ~3u, value);
+        if (flat_write_) {
+            flat_write_[addr] = value;
+        } else {
+            WritablePage(addr >> kPageShift)[addr & (kPageSize - 1)] = value;
+        }
+        NoteWrite(addr, 1);
     }
 
+    // Word accesses inline only the flat-RAM case; paged and device accesses are out of line.
     uint32_t Read32(uint32_t addr) override {
-        if (addr + 4 > size_) return 0;
-        uint32_t v = 0;
-        std::memcpy(&v, &data_[addr], sizeof(v));
-        return v;
+        if (flat_read_ && uint64_t{addr} + 4 <= size_) {
+            uint32_t v;
+            std::memcpy(&v, flat_read_ + addr, sizeof(v));
+            return v;
+        }
+        return Read32Paged(addr);
     }
 
     void Write32(uint32_t addr, uint32_t value) override {
-        if (addr + 4 > size_) return;
-        std::memcpy(&data_[addr], &value, sizeof(value));
+        if (flat_write_ && uint64_t{addr} + 4 <= size_) {
+            std::memcpy(flat_write_ + addr, &value, sizeof(value));
+            NoteWrite(addr, 4);
+            return;
+        }
+        Write32Paged(addr, value);
     }
 
     uint32_t size() const { return size_; }
 
+    bool Contains(uint32_t addr, uint32_t len) const {
+        return addr <= size_ && len <= size_ - addr;
+    }
+
+    // Bulk copies split at page boundaries (DMA). The range must satisfy Contains().
+    void ReadBlock(uint32_t addr, void* out, uint32_t len) const {
+        auto* dst = static_cast<uint8_t*>(out);
+        while (len > 0) {
+            uint32_t off = addr & (kPageSize - 1);
+            uint32_t n = std::min(len, kPageSize - off);
+            std::memcpy(dst, read_pages_[addr >> kPageShift] + off, n);
+            addr += n;
+            dst += n;
+            len -= n;
+        }
+    }
+
+    void WriteBlock(uint32_t addr, const void* in, uint32_t len) {
+        NoteWrite(addr, len);
+        auto* src = static_cast<const uint8_t*>(in);
+        while (len > 0) {
+            uint32_t off = addr & (kPageSize - 1);
+            uint32_t n = std::min(len, kPageSize - off);
+            std::memcpy(WritablePage(addr >> kPageShift) + off, src, n);
+            addr += n;
+            src += n;
+            len -= n;
+        }
+    }
+
+    // Attach a device window; it must lie above RAM.
+    void MapDevice(uint32_t base, uint32_t size, IDevice* device) {
+        if (base >= size_) mmio_.Map(base, size, device);
+    }
+
+    // True once after any device register write; the CPU stops its straight-line run so the
+    // emulator can apply the device's side effects at the right time.
+    bool io_written() const { return io_written_.load(std::memory_order_relaxed); }
+    bool TakeIoWrite() { return io_written_.exchange(false, std::memory_order_relaxed); }
+
+    // Concurrent mode lets several host threads write through this Memory at once. Entering it
+    // makes every page writable up front (copy-on-write and checkpoint pre-images), so the
+    // store paths never change the page tables while other threads read them. Decode-cache
+    // invalidations are queued until FlushDeferredCode(), i.e. a CPU may run stale code it (or
+    // another CPU) wrote until the next quantum boundary. A write that lands between another
+    // CPU's decode and its MarkCode() is not reported at all, so FlushDeferredCode() also has
+    // the caches re-check what they decoded during the quantum. Guest data races between CPUs
+    // are not ordered beyond that.
+    void BeginConcurrent() {
+        for (uint32_t page = 0; page < read_pages_.size(); ++page) WritablePage(page);
+        concurrent_ = true;
+    }
+
+    void EndConcurrent() {
+        concurrent_ = false;
+        FlushDeferredCode();
+    }
+
+    // Call with no other thread running CPUs.
+    void FlushDeferredCode() {
+        for (uint32_t page : deferred_code_) {
+            for (ICodeObserver* o : code_observers_) o->InvalidateCode(page);
+        }
+        deferred_code_.clear();
+        for (ICodeObserver* o : code_observers_) o->RevalidateCode();
+    }
+
+    // Set only while no CPU thread runs, so CPU threads may read it without synchronization.
+    bool concurrent() const { return concurrent_; }
+
+    // Number of pages that still point into the shared image.
+    uint32_t SharedPages() const { return shared_count_; }
+
+    // Make the current contents the restore point. Cost is proportional to the pages dirtied
+    // since the previous checkpoint (all pages the first time).
+    void Checkpoint() {
+        for (uint32_t page : undo_list_) undo_valid_[page] = 0;
+        undo_list_.clear();
+        if (!tracking_) {
+            tracking_ = true;
+            flat_write_ = nullptr;
+            std::fill(write_pages_.begin(), write_pages_.end(), nullptr);
+        } else {
+            for (uint32_t page : dirty_list_) write_pages_[page] = nullptr;
+        }
+        dirty_list_.clear();
+        checkpoint_io_written_ = io_written();
+    }
+
+    // Return to the last checkpoint; can be repeated. Cost is proportional to dirtied pages.
+    void Restore() {
+        for (uint32_t page : dirty_list_) {
+            std::memcpy(ram_.get() + (page << kPageShift), undo_pages_[page].get(), kPageSize);
+            write_pages_[page] = nullptr;
+            NoteWrite(page << kPageShift, std::min(kPageSize, size_ - (page << kPageShift)));
+        }
+        dirty_list_.clear();
+        io_written_.store(checkpoint_io_written_, std::memory_order_relaxed);
+    }
+
+    uint32_t DirtyPages() const { return static_cast<uint32_t>(dirty_list_.size()); }
+
+    // Code tracking for decode caches. addr must be < size().
+    void MarkCode(uint32_t addr) {
+        page_is_code_[addr >> kCodePageShift].store(1, std::memory_order_relaxed);
+    }
+
+    void AddCodeObserver(ICodeObserver* o) { code_observers_.push_back(o); }
+    void RemoveCodeObserver(ICodeObserver* o) {
+        code_observers_.erase(std::remove(code_observers_.begin(), code_observers_.end(), o),
+                              code_observers_.end());
+    }
+
 private:
+    __attribute__((noinline)) uint32_t Read32Paged(uint32_t addr) {
+        if (uint64_t{addr} + 4 > size_) return ReadIo(addr);
+        uint32_t v = 0;
+        uint32_t off = addr & (kPageSize - 1);
+        if (off <= kPageSize - 4) {
+            std::memcpy(&v, read_pages_[addr >> kPageShift] + off, sizeof(v));
+        } else {
+            ReadBlock(addr, &v, sizeof(v));
+        }
+        return v;
+    }
+
+    __attribute__((noinline)) void Write32Paged(uint32_t addr, uint32_t value) {
+        if (uint64_t{addr} + 4 > size_) return WriteIo(addr, value);
+        uint32_t off = addr & (kPageSize - 1);
+        if (off <= kPageSize - 4) {
+            std::memcpy(WritablePage(addr >> kPageShift) + off, &value, sizeof(value));
+            NoteWrite(addr, 4);
+        } else {
+            WriteBlock(addr, &value, sizeof(value));
+        }
+    }
+
+    // Devices are not thread-safe; the lock is uncontended unless CPUs run concurrently. Kept
+    // out of line so the RAM paths stay small enough to inline into the CPU loop.
+    __attribute__((noinline)) uint32_t ReadIo(uint32_t addr) {
+        const MmioMap::Slot* slot = mmio_.Find(addr);
+        if (!slot) return 0;
+        std::lock_guard<std::mutex> lock(slow_mutex_);
+        return slot->device->ReadReg(addr - slot->base);
+    }
+
+    __attribute__((noinline)) void WriteIo(uint32_t addr, uint32_t value) {
+        const MmioMap::Slot* slot = mmio_.Find(addr);
+        if (!slot) return;
+        std::lock_guard<std::mutex> lock(slow_mutex_);
+        slot->device->WriteReg(addr - slot->base, value);
+        io_written_.store(true, std::memory_order_relaxed);
+    }
+
+    uint8_t* WritablePage(uint32_t page) {
+        uint8_t* p = write_pages_[page];
+        return p ? p : FirstWrite(page);
+    }
+
+    // Slow path of the first write to a page since construction or the last checkpoint.
+    uint8_t* FirstWrite(uint32_t page) {
+        if (tracking_) {
+            if (!undo_valid_[page]) {
+                if (!undo_pages_[page]) undo_pages_[page] = std::make_unique<uint8_t[]>(kPageSize);
+                std::memcpy(undo_pages_[page].get(), read_pages_[page], kPageSize);
+                undo_valid_[page] = 1;
+                undo_list_.push_back(page);
+            }
+            dirty_list_.push_back(page);
+        }
+        if (!owned_[page]) return CopyOnWrite(page);
+        write_pages_[page] = ram_.get() + (page << kPageShift);
+        return write_pages_[page];
+    }
+
+    uint8_t* CopyOnWrite(uint32_t page) {
+        uint8_t* p = ram_.get() + (page << kPageShift);  // still zero-filled
+        uint64_t begin = uint64_t{page} << kPageShift;
+        if (read_pages_[page]) {
+            std::memcpy(p, read_pages_[page], kPageSize);
+        } else if (image_ && begin < image_->size()) {
+            std::memcpy(p, image_->data() + begin, image_->size() - begin);
+        }
+        read_pages_[page] = p;
+        write_pages_[page] = p;
+        owned_[page] = 1;
+        if (--shared_count_ == 0) {
+            flat_read_ = ram_.get();
+            if (!tracking_) flat_write_ = ram_.get();
+        }
+        return p;
+    }
+
+    void NoteWrite(uint32_t addr, uint32_t len) {
+        uint32_t last = (addr + len - 1) >> kCodePageShift;
+        for (uint32_t page = addr >> kCodePageShift; page <= last; ++page) {
+            if (page_is_code_[page].load(std::memory_order_relaxed) &&
+                page_is_code_[page].exchange(0, std::memory_order_relaxed)) {
+                if (concurrent_) {
+                    std::lock_guard<std::mutex> lock(slow_mutex_);
+                    deferred_code_.push_back(page);
+                } else {
+                    for (ICodeObserver* o : code_observers_) o->InvalidateCode(page);
+                }
+            }
+        }
+    }
+
     uint32_t size_;
-    std::vector<uint8_t> data_;
+    MemoryImage image_;
+    std::vector<const uint8_t*> read_pages_;
+    std::vector<uint8_t*> write_pages_;  // nullptr: shared with image_ or clean since checkpoint
+    struct FreeDeleter {
+        void operator()(uint8_t* p) const { std::free(p); }
+    };
+    std::unique_ptr<uint8_t[], FreeDeleter> ram_;  // private pages, at their guest offsets
+    std::vector<uint8_t> owned_;                   // page lives in ram_
+    uint32_t shared_count_;
+    const uint8_t* flat_read_ = nullptr;  // ram_ once no page is shared
+    uint8_t* flat_write_ = nullptr;       // ram_ once no page is shared, until tracking starts
+    // Checkpoint state
+    bool tracking_ = false;
+    std::vector<std::unique_ptr<uint8_t[]>> undo_pages_;  // pre-images, reused across checkpoints
+    std::vector<uint8_t> undo_valid_;
+    std::vector<uint32_t> undo_list_;   // pages with a valid pre-image
+    std::vector<uint32_t> dirty_list_;  // pages written since checkpoint/restore
+    bool checkpoint_io_written_ = false;  // device write not yet synced at checkpoint
+    std::unique_ptr<std::atomic<uint8_t>[]> page_is_code_;  // set by any CPU's decode cache
+    std::vector<ICodeObserver*> code_observers_;
+    MmioMap mmio_;
+    std::atomic<bool> io_written_{false};
+    // Concurrent (threaded multi-CPU) mode
+    bool concurrent_ = false;
+    std::mutex slow_mutex_;  // device accesses and deferred_code_
+    std::vector<uint32_t> deferred_code_;
 };
 
-// IRQ: manages pending (IP) and enable (IE) bits for multiple IRQs
+// IRQ: manages pending (IP) and enable (IE) bits for multiple IRQs.
+// Bits are packed into 64-bit words; summary_ has one bit per word whose (pending & enabled)
+// is non-zero, so both "anything to take?" and "which one?" are a couple of ctz operations.
 class InterruptController {
 public:
+    static constexpr uint32_t kMaxIrqs = 64 * 64;  // one summary word covers 64 words
+
     explicit InterruptController(uint32_t irq_count)
-        : pending_(irq_count, false), enabled_(irq_count, false) {}
+        : irq_count_(std::min(irq_count, kMaxIrqs)),
+          pending_((irq_count_ + 63) / 64, 0),
+          enabled_((irq_count_ + 63) / 64, 0),
+          summary_(0) {}
 
     void RequestInterrupt(uint32_t irq_id) {
-        if (irq_id < pending_.size()) pending_[irq_id] = true;
+        if (irq_id >= irq_count_) return;
+        pending_[irq_id / 64] |= Bit(irq_id);
+        Update(irq_id / 64);
     }
 
     void EnableInterrupt(uint32_t irq_id) {
-        if (irq_id < enabled_.size()) enabled_[irq_id] = true;
+        if (irq_id >= irq_count_) return;
+        enabled_[irq_id / 64] |= Bit(irq_id);
+        Update(irq_id / 64);
     }
 
     void DisableInterrupt(uint32_t irq_id) {
-        if (irq_id < enabled_.size()) enabled_[irq_id] = false;
+        if (irq_id >= irq_count_) return;
+        enabled_[irq_id / 64] &= ~Bit(irq_id);
+        Update(irq_id / 64);
     }
 
+    // Cheap check for the CPU: a single load.
+    bool HasPendingEnabled() const { return summary_ != 0; }
+
     // Return the lowest-numbered pending+enabled interrupt, or -1 if none.
-    int32_t GetPendingEnabledInterrupt() {
-        for (uint32_t i = 0; i < pending_.size(); ++i) {
-            if (pending_[i] && enabled_[i]) return static_cast<int32_t>(i);
-        }
-        return -1;
+    int32_t GetPendingEnabledInterrupt() const {
+        if (summary_ == 0) return -1;
+        uint32_t w = static_cast<uint32_t>(__builtin_ctzll(summary_));
+        uint64_t active = pending_[w] & enabled_[w];
+        return static_cast<int32_t>(w * 64 + __builtin_ctzll(active));
     }
 
     void ClearPending(uint32_t irq_id) {
-        if (irq_id < pending_.size()) pending_[irq_id] = false;
+        if (irq_id >= irq_count_) return;
+        pending_[irq_id / 64] &= ~Bit(irq_id);
+        Update(irq_id / 64);
     }
 
 private:
-    std::vector<bool> pending_;
-    std::vector<bool> enabled_;
+    static uint64_t Bit(uint32_t irq_id) { return uint64_t{1} << (irq_id % 64); }
+
+    void Update(uint32_t w) {
+        if (pending_[w] & enabled_[w]) {
+            summary_ |= uint64_t{1} << w;
+        } else {
+            summary_ &= ~(uint64_t{1} << w);
+        }
+    }
+
+    uint32_t irq_count_;
+    std::vector<uint64_t> pending_;
+    std::vector<uint64_t> enabled_;
+    uint64_t summary_;
 };
 
-// Timer: counts ticks and requests an interrupt when period elapses
-class Timer {
+// Device side of the event queue: a device schedules a deadline and gets a callback when
+// simulated time reaches it, instead of being ticked every cycle.
+class IEventTarget {
 public:
-    Timer() : period_ticks_(0), irq_id_(0), ic_ptr_(nullptr), tick_count_(0) {}
+    virtual ~IEventTarget() = default;
+    virtual void OnEvent(uint64_t now) = 0;
+};
 
-    Timer(uint32_t period_ticks, uint32_t irq_id, InterruptController& ic)
-        : period_ticks_(period_ticks), irq_id_(irq_id), ic_ptr_(&ic), tick_count_(0) {}
+// EventQueue: min-heap of deadlines (in ticks). The emulator runs the CPU straight-line up to
+// the nearest deadline and only then fires the due events and checks interrupts.
+class EventQueue {
+public:
+    static constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
 
-    void Tick() {
-        if (!ic_ptr_) return;
-        ++tick_count_;
-        if (tick_count_ >= period_ticks_) {
-            tick_count_ = 0;
-            // 触发中断
-            ic_ptr_->RequestInterrupt(irq_id_);
+    void Schedule(uint64_t deadline, IEventTarget* target) {
+        heap_.push(Event{deadline, next_seq_++, target});
+    }
+
+    uint64_t NextDeadline() const { return heap_.empty() ? kNever : heap_.top().deadline; }
+
+    // Fire every event whose deadline <= now. Targets may reschedule themselves from OnEvent.
+    void RunDue(uint64_t now) {
+        while (!heap_.empty() && heap_.top().deadline <= now) {
+            Event ev = heap_.top();
+            heap_.pop();
+            ev.target->OnEvent(now);
+        }
+    }
+
+private:
+    struct Event {
+        uint64_t deadline;
+        uint64_t seq;  // FIFO order for events with the same deadline
+        IEventTarget* target;
+
+        bool operator>(const Event& o) const {
+            return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
         }
+    };
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> heap_;
+    uint64_t next_seq_ = 0;
+};
+
+// Timer: requests an interrupt every period_ticks, driven by the event queue. Stop() and a
+// restart leave a stale event in the queue; OnEvent ignores anything before next_deadline_.
+class Timer : public IEventTarget {
+public:
+    struct State {
+        uint32_t period_ticks;
+        uint32_t irq_id;
+        bool running;
+        uint64_t next_deadline;
+    };
+
+    Timer(uint32_t period_ticks, uint32_t irq_id, InterruptController& ic, EventQueue& events)
+        : state_{period_ticks ? period_ticks : 1, irq_id, false, 0}, ic_(ic), events_(events) {}
+
+    void Start(uint64_t now) {
+        state_.running = true;
+        state_.next_deadline = now + state_.period_ticks;
+        events_.Schedule(state_.next_deadline, this);
+    }
+
+    void Stop() { state_.running = false; }
+    bool running() const { return state_.running; }
+
+    // Take effect at the next Start().
+    void SetPeriod(uint32_t period_ticks) { state_.period_ticks = period_ticks ? period_ticks : 1; }
+    void SetIrq(uint32_t irq_id) { state_.irq_id = irq_id; }
+    uint32_t period() const { return state_.period_ticks; }
+    uint32_t irq() const { return state_.irq_id; }
+
+    State SaveState() const { return state_; }
+    void LoadState(const State& st) { state_ = st; }
+
+    void OnEvent(uint64_t now) override {
+        if (!state_.running || now < state_.next_deadline) return;
+        // 触发中断, 并预约下一个周期
+        ic_.RequestInterrupt(state_.irq_id);
+        state_.next_deadline = now + state_.period_ticks;
+        events_.Schedule(state_.next_deadline, this);
     }
 
 private:
-    uint32_t period_ticks_;
-    uint32_t irq_id_;
-    InterruptController* ic_ptr_;
-    uint32_t tick_count_;
+    State state_;
+    InterruptController& ic_;
+    EventQueue& events_;
+};
+
+// One element of a scatter-gather list.
+struct DmaDescriptor {
+    uint32_t src;
+    uint32_t dst;
+    uint32_t len;
 };
 
-// DMA: performs a blocking transfer in one call
+// DMA: multi-channel engine that walks a descriptor list in chunks over simulated time and
+// raises the channel's IRQ when the whole list is done. When both ranges of a chunk lie in
+// RAM the chunk is copied with page-sized memcpys on the backing store.
 class Dma {
 public:
-    void Transfer(IMemory& mem, uint32_t src, uint32_t dst, uint32_t len) {
-        for (uint32_t i = 0; i < len; ++i) {
-            uint8_t b = mem.ReadByte(src + i);
-            mem.WriteByte(dst + i, b);
+    static constexpr uint32_t kChunkBytes = 64;
+    static constexpr uint32_t kDescBytes = 12;  // guest descriptor size
+
+    Dma(Memory& mem, InterruptController& ic, EventQueue& events, uint32_t channel_count,
+        uint32_t bytes_per_tick = 4)
+        : mem_(mem),
+          ic_(ic),
+          events_(events),
+          bytes_per_tick_(bytes_per_tick ? bytes_per_tick : 1),
+          channels_(channel_count) {
+        for (Channel& c : channels_) c.dma = this;
+    }
+
+    // Queue a descriptor list on an idle channel. Returns false if the channel is busy or
+    // does not exist.
+    bool Start(uint32_t channel, std::vector<DmaDescriptor> list, uint32_t irq_id, uint64_t now) {
+        if (channel >= channels_.size() || channels_[channel].busy) return false;
+        Channel& c = channels_[channel];
+        c.list = std::move(list);
+        c.index = 0;
+        c.offset = 0;
+        c.irq_id = irq_id;
+        c.busy = true;
+        events_.Schedule(now + 1, &c);
+        return true;
+    }
+
+    bool Busy(uint32_t channel) const {
+        return channel < channels_.size() && channels_[channel].busy;
+    }
+
+    // Start a channel from a descriptor array in guest RAM (12 bytes each: src, dst, len).
+    // Returns false if the channel is busy or does not exist, or if the array does not lie
+    // entirely in RAM; desc_count comes from the guest, so it is bounded before allocating.
+    bool StartFromMemory(uint32_t channel,
+                         uint32_t desc_addr,
+                         uint32_t desc_count,
+                         uint32_t irq_id,
+                         uint64_t now) {
+        if (channel >= channels_.size() || channels_[channel].busy) return false;
+        if (desc_addr > mem_.size() || desc_count > (mem_.size() - desc_addr) / kDescBytes) {
+            return false;
+        }
+        std::vector<DmaDescriptor> list(desc_count);
+        for (uint32_t i = 0; i < desc_count; ++i) {
+            uint32_t at = desc_addr + i * kDescBytes;
+            list[i] = DmaDescriptor{mem_.Read32(at), mem_.Read32(at + 4), mem_.Read32(at + 8)};
+        }
+        return Start(channel, std::move(list), irq_id, now);
+    }
+
+    uint32_t channel_count() const { return static_cast<uint32_t>(channels_.size()); }
+
+    // Progress of one channel, for checkpoints. reg_* are the guest-visible registers.
+    struct ChannelState {
+        std::vector<DmaDescriptor> list;
+        size_t index = 0;     // current descriptor
+        uint32_t offset = 0;  // bytes done in current descriptor
+        uint32_t irq_id = 0;
+        bool busy = false;
+        uint32_t reg_desc_addr = 0;
+        uint32_t reg_desc_count = 0;
+        uint32_t reg_irq = 0;
+        bool reg_start = false;  // start requested, applied by DmaDevice::Sync
+        bool reg_error = false;  // last requested start was rejected
+    };
+
+    ChannelState& channel_state(uint32_t channel) { return channels_[channel]; }
+
+    std::vector<ChannelState> SaveState() const {
+        return std::vector<ChannelState>(channels_.begin(), channels_.end());
+    }
+
+    void LoadState(const std::vector<ChannelState>& state) {
+        for (size_t i = 0; i < channels_.size() && i < state.size(); ++i) {
+            static_cast<ChannelState&>(channels_[i]) = state[i];
+        }
+    }
+
+private:
+    struct Channel : IEventTarget, ChannelState {
+        Dma* dma = nullptr;
+
+        void OnEvent(uint64_t now) override { dma->Advance(*this, now); }
+    };
+
+    // Move one chunk, then either schedule the next one or signal completion.
+    void Advance(Channel& c, uint64_t now) {
+        while (c.index < c.list.size() && c.offset >= c.list[c.index].len) {
+            ++c.index;
+            c.offset = 0;
+        }
+        if (c.index == c.list.size()) {
+            c.busy = false;
+            c.list.clear();
+            ic_.RequestInterrupt(c.irq_id);
+            return;
+        }
+        const DmaDescriptor& d = c.list[c.index];
+        uint32_t n = std::min(kChunkBytes, d.len - c.offset);
+        Copy(d.src + c.offset, d.dst + c.offset, n);
+        c.offset += n;
+        events_.Schedule(now + (n + bytes_per_tick_ - 1) / bytes_per_tick_, &c);
+    }
+
+    void Copy(uint32_t src, uint32_t dst, uint32_t len) {
+        if (mem_.Contains(src, len) && mem_.Contains(dst, len)) {
+            uint8_t buf[kChunkBytes];  // len <= kChunkBytes; bouncing makes overlap safe
+            mem_.ReadBlock(src, buf, len);
+            mem_.WriteBlock(dst, buf, len);
+            return;
+        }
+        // Partly outside RAM: fall back to per-byte accesses with the usual bounds semantics.
+        for (uint32_t i = 0; i < len; ++i) mem_.WriteByte(dst + i, mem_.ReadByte(src + i));
+    }
+
+    Memory& mem_;
+    InterruptController& ic_;
+    EventQueue& events_;
+    uint32_t bytes_per_tick_;
+    std::vector<Channel> channels_;
+};
+
+// Guest-visible register blocks. Writes that need the current time (starting a timer or a DMA)
+// are latched and applied by Sync(now), which the emulator calls when the CPU stops after an
+// I/O write.
+
+// TimerDevice: one 16-byte block per timer: +0 PERIOD, +4 IRQ, +8 CTRL (1 start, 0 stop; reads
+// back running).
+class TimerDevice : public IDevice {
+public:
+    void Attach(Timer* timer) {
+        timers_.push_back(timer);
+        start_.push_back(0);
+    }
+
+    uint32_t ReadReg(uint32_t offset) override {
+        uint32_t i = offset / 16;
+        if (i >= timers_.size()) return 0;
+        switch (offset % 16) {
+            case 0x0: return timers_[i]->period();
+            case 0x4: return timers_[i]->irq();
+            case 0x8: return timers_[i]->running();
+            default: return 0;
+        }
+    }
+
+    void WriteReg(uint32_t offset, uint32_t value) override {
+        uint32_t i = offset / 16;
+        if (i >= timers_.size()) return;
+        switch (offset % 16) {
+            case 0x0: timers_[i]->SetPeriod(value); break;
+            case 0x4: timers_[i]->SetIrq(value); break;
+            case 0x8:
+                if (value) {
+                    start_[i] = 1;
+                } else {
+                    timers_[i]->Stop();
+                    start_[i] = 0;
+                }
+                break;
+            default: break;
+        }
+    }
+
+    void Sync(uint64_t now) {
+        for (size_t i = 0; i < timers_.size(); ++i) {
+            if (start_[i]) timers_[i]->Start(now);
+            start_[i] = 0;
+        }
+    }
+
+    // Start requests not yet applied by Sync(), for checkpoints.
+    std::vector<uint8_t> SaveState() const { return start_; }
+    void LoadState(const std::vector<uint8_t>& start) {
+        for (size_t i = 0; i < start_.size(); ++i) start_[i] = i < start.size() ? start[i] : 0;
+    }
+
+private:
+    std::vector<Timer*> timers_;
+    std::vector<uint8_t> start_;
+};
+
+// DmaDevice: one 16-byte block per channel: +0 DESC_ADDR, +4 DESC_COUNT, +8 IRQ, +C CTRL
+// (write 1 to start; reads back bit 0 busy, bit 1 error). ERROR is set when a start is
+// rejected (channel still busy, or the descriptor array is not in RAM) and cleared by the
+// next start.
+class DmaDevice : public IDevice {
+public:
+    explicit DmaDevice(Dma& dma) : dma_(dma) {}
+
+    uint32_t ReadReg(uint32_t offset) override {
+        uint32_t ch = offset / 16;
+        if (ch >= dma_.channel_count()) return 0;
+        const Dma::ChannelState& c = dma_.channel_state(ch);
+        switch (offset % 16) {
+            case 0x0: return c.reg_desc_addr;
+            case 0x4: return c.reg_desc_count;
+            case 0x8: return c.reg_irq;
+            case 0xC: return (c.busy || c.reg_start) | (c.reg_error << 1);
+            default: return 0;
+        }
+    }
+
+    void WriteReg(uint32_t offset, uint32_t value) override {
+        uint32_t ch = offset / 16;
+        if (ch >= dma_.channel_count()) return;
+        Dma::ChannelState& c = dma_.channel_state(ch);
+        switch (offset % 16) {
+            case 0x0: c.reg_desc_addr = value; break;
+            case 0x4: c.reg_desc_count = value; break;
+            case 0x8: c.reg_irq = value; break;
+            case 0xC:
+                c.reg_start = value != 0;
+                if (c.reg_start) c.reg_error = false;
+                break;
+            default: break;
+        }
+    }
+
+    void Sync(uint64_t now) {
+        for (uint32_t ch = 0; ch < dma_.channel_count(); ++ch) {
+            Dma::ChannelState& c = dma_.channel_state(ch);
+            if (!c.reg_start) continue;
+            c.reg_start = false;
+            c.reg_error = !dma_.StartFromMemory(ch, c.reg_desc_addr, c.reg_desc_count, c.reg_irq,
+                                                now);
+        }
+    }
+
+private:
+    Dma& dma_;
+};
+
+// IrqDevice: +0 ENABLE (write irq id), +4 DISABLE (write irq id), +8 CLEAR pending (write irq
+// id), +C ACTIVE (reads the lowest pending+enabled irq, or 0xFFFFFFFF).
+class IrqDevice : public IDevice {
+public:
+    explicit IrqDevice(InterruptController& ic) : ic_(ic) {}
+
+    uint32_t ReadReg(uint32_t offset) override {
+        return offset == 0xC ? static_cast<uint32_t>(ic_.GetPendingEnabledInterrupt()) : 0;
+    }
+
+    void WriteReg(uint32_t offset, uint32_t value) override {
+        switch (offset) {
+            case 0x0: ic_.EnableInterrupt(value); break;
+            case 0x4: ic_.DisableInterrupt(value); break;
+            case 0x8: ic_.ClearPending(value); break;
+            default: break;
+        }
+    }
+
+private:
+    InterruptController& ic_;
+};
+
+// Tracing. A trace record is a fixed 16-byte event: an executed opcode, or kTraceIrq for an
+// interrupt entry. a/b hold the opcode's operands (immediate/address, resulting acc/value).
+constexpr uint8_t kTraceIrq = 0x01;  // not a valid opcode
+
+struct TraceRecord {
+    uint32_t pc;
+    uint32_t a;
+    uint32_t b;
+    uint8_t kind;
+    uint8_t pad[3];
+};
+static_assert(sizeof(TraceRecord) == 16, "trace records are written to disk as-is");
+
+// Same text for live iostream tracing and for the offline pretty-printer.
+inline void FormatTraceRecord(std::ostream& os, const TraceRecord& t) {
+    switch (t.kind) {
+        case kTraceIrq:
+            os << "[CPU] IRQ " << t.a << " taken at pc=" << t.pc << '\n';
+            break;
+        case kOpNop:
+            os << "[CPU] EXEC NOP pc=" << t.pc << '\n';
+            break;
+        case kOpLoadImm:
+            os << "[CPU] EXEC LOAD_IMM pc=" << t.pc << " imm=" << t.a << " -> acc=" << t.b << '\n';
+            break;
+        case kOpStore:
+            os << "[CPU] EXEC STORE pc=" << t.pc << " addr=" << t.a << " value=" << t.b << '\n';
+            break;
+        case kOpAddImm:
+            os << "[CPU] EXEC ADD_IMM pc=" << t.pc << " imm=" << t.a << " -> acc=" << t.b << '\n';
+            break;
+        case kOpSubImm:
+            os << "[CPU] EXEC SUB_IMM pc=" << t.pc << " imm=" << t.a << " -> acc=" << t.b << '\n';
+            break;
+        case kOpJmp:
+            os << "[CPU] EXEC JMP pc=" << t.pc << " -> " << t.a << '\n';
+            break;
+        case kOpPrint:
+            os << "[CPU] EXEC PRINT pc=" << t.pc << " addr=" << t.a << '\n';
+            break;
+        case kOpIret:
+            os << "[CPU] EXEC IRET returning to pc=" << t.a << '\n';
+            break;
+        case kOpHalt:
+            os << "[CPU] EXEC HALT pc=" << t.pc << '\n';
+            break;
+        default:
+            os << "[CPU] TRACE kind=0x" << std::hex << int(t.kind) << std::dec << " pc=" << t.pc
+               << '\n';
+            break;
+    }
+}
+
+// TraceBuffer: per-emulator buffer of binary trace records. With an output file, a full buffer
+// is written out in one bulk write; without one, it is a ring that keeps the latest records.
+class TraceBuffer {
+public:
+    static constexpr char kMagic[8] = {'E', 'M', 'U', 'T', 'R', 'C', '1', '\0'};
+
+    // Storage is allocated on the first Push, so idle emulators don't pay for it.
+    explicit TraceBuffer(size_t capacity = 1 << 16) : capacity_(capacity ? capacity : 1) {}
+    ~TraceBuffer() { Flush(); }
+
+    TraceBuffer(const TraceBuffer&) = delete;
+    TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+    bool Open(const std::string& path) {
+        Flush();
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        if (!file_.is_open()) return false;
+        file_.write(kMagic, sizeof(kMagic));
+        head_ = 0;
+        wrapped_ = false;
+        return true;
+    }
+
+    void Push(const TraceRecord& t) {
+        if (head_ == records_.size()) MakeRoom();
+        records_[head_++] = t;
+    }
+
+    void Flush() {
+        if (!file_.is_open()) return;
+        WriteOut();
+        file_.flush();
+    }
+
+    // Buffered records, oldest first (only meaningful without an output file).
+    std::vector<TraceRecord> Snapshot() const {
+        std::vector<TraceRecord> out;
+        if (wrapped_) out.assign(records_.begin() + head_, records_.end());
+        out.insert(out.end(), records_.begin(), records_.begin() + head_);
+        return out;
+    }
+
+    // Offline pretty-printer for a file produced by Open()/Flush().
+    static bool Print(const std::string& path, std::ostream& os) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[sizeof(kMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+            return false;
+        }
+        std::vector<TraceRecord> chunk(4096);
+        while (in) {
+            in.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(TraceRecord));
+            size_t n = static_cast<size_t>(in.gcount()) / sizeof(TraceRecord);
+            for (size_t i = 0; i < n; ++i) FormatTraceRecord(os, chunk[i]);
         }
+        return true;
     }
+
+private:
+    void MakeRoom() {
+        if (records_.empty()) {
+            records_.resize(capacity_);
+        } else if (file_.is_open()) {
+            WriteOut();
+        } else {
+            head_ = 0;
+            wrapped_ = true;
+        }
+    }
+
+    void WriteOut() {
+        file_.write(reinterpret_cast<const char*>(records_.data()), head_ * sizeof(TraceRecord));
+        head_ = 0;
+    }
+
+    size_t capacity_;
+    std::vector<TraceRecord> records_;
+    size_t head_ = 0;
+    bool wrapped_ = false;
+    std::ofstream file_;
+};
+
+// Trace policies for BasicCpu, chosen at compile time:
+//   NoTrace     - compiles to nothing.
+//   TextTrace   - prints each event to std::cout when enabled (slow, for short demos).
+//   BinaryTrace - appends 16-byte records to a TraceBuffer when enabled.
+struct NoTrace {
+    void SetEnabled(bool) {}
+    void SetSink(TraceBuffer*) {}
+    void Record(uint8_t, uint32_t, uint32_t = 0, uint32_t = 0) {}
+};
+
+class TextTrace {
+public:
+    void SetEnabled(bool enable) { enabled_ = enable; }
+    void SetSink(TraceBuffer*) {}
+    void Record(uint8_t kind, uint32_t pc, uint32_t a = 0, uint32_t b = 0) {
+        if (enabled_) FormatTraceRecord(std::cout, TraceRecord{pc, a, b, kind, {}});
+    }
+
+private:
+    bool enabled_ = false;
 };
 
-// CPU: simple PV CPU that executes one instruction per Step().
-class Cpu {
+class BinaryTrace {
 public:
-    Cpu(IMemory& mem, InterruptController& ic)
-        : mem_(mem), ic_(ic), pc_(0), sp_(0), acc_(0), halted_(false), trace_(false) {}
+    void SetEnabled(bool enable) {
+        enabled_ = enable;
+        active_ = enabled_ ? sink_ : nullptr;
+    }
+    void SetSink(TraceBuffer* sink) {
+        sink_ = sink;
+        active_ = enabled_ ? sink_ : nullptr;
+    }
+    void Record(uint8_t kind, uint32_t pc, uint32_t a = 0, uint32_t b = 0) {
+        if (active_) active_->Push(TraceRecord{pc, a, b, kind, {}});
+    }
+
+private:
+    TraceBuffer* sink_ = nullptr;
+    TraceBuffer* active_ = nullptr;
+    bool enabled_ = false;
+};
+
+// Policy used by Emulator; build with -DEMU_TRACE=BinaryTrace (or NoTrace) to switch.
+#ifndef EMU_TRACE
+#define EMU_TRACE TextTrace
+#endif
+
+// A decoded instruction: opcode selects the handler in BasicCpu::Execute().
+struct DecodedInsn {
+    uint32_t imm;
+    uint8_t opcode;
+    uint8_t length;
+};
+
+// Direct-mapped cache of decoded instructions keyed by pc. Entries are dropped as soon as
+// Memory reports a write to their code page, so a hit needs no further validation (in
+// concurrent mode, see Memory::BeginConcurrent(), only from the next quantum on).
+class DecodeCache : public ICodeObserver {
+public:
+    static constexpr uint32_t kSize = 4096;  // power of two, multiple of the code page size
+
+    explicit DecodeCache(Memory& mem) : mem_(mem), entries_(kSize) { mem_.AddCodeObserver(this); }
+    ~DecodeCache() override { mem_.RemoveCodeObserver(this); }
+
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    const DecodedInsn* Find(uint32_t pc) const {
+        const Entry& e = entries_[pc & (kSize - 1)];
+        return (e.pc == pc && e.valid) ? &e.insn : nullptr;
+    }
+
+    // Only instructions that lie in RAM within a single code page are cached.
+    void Insert(uint32_t pc, const DecodedInsn& insn) {
+        uint32_t last = pc + insn.length - 1;
+        if (!mem_.Contains(pc, insn.length) ||
+            (pc >> Memory::kCodePageShift) != (last >> Memory::kCodePageShift)) {
+            return;
+        }
+        mem_.MarkCode(pc);
+        entries_[pc & (kSize - 1)] = Entry{pc, insn, true};
+        if (mem_.concurrent()) inserted_.push_back(pc);
+    }
+
+    void InvalidateCode(uint32_t page) override {
+        uint32_t base = page << Memory::kCodePageShift;
+        for (uint32_t i = 0; i < (1u << Memory::kCodePageShift); ++i) {
+            entries_[(base + i) & (kSize - 1)].valid = false;
+        }
+    }
+
+    // Drop entries inserted during the quantum whose bytes no longer match memory.
+    void RevalidateCode() override {
+        for (uint32_t pc : inserted_) {
+            Entry& e = entries_[pc & (kSize - 1)];
+            if (!e.valid || e.pc != pc) continue;
+            if (mem_.ReadByte(pc) != e.insn.opcode ||
+                (e.insn.length > 1 && mem_.Read32(pc + 1) != e.insn.imm)) {
+                e.valid = false;
+            }
+        }
+        inserted_.clear();
+    }
+
+private:
+    struct Entry {
+        uint32_t pc = 0;
+        DecodedInsn insn{};
+        bool valid = false;
+    };
+
+    Memory& mem_;
+    std::vector<Entry> entries_;
+    std::vector<uint32_t> inserted_;  // pcs inserted in concurrent mode since the last check
+};
+
+// CPU: simple PV CPU that executes one instruction per Step(). Run() executes straight-line
+// without polling the interrupt controller; the emulator calls CheckInterrupts() at event
+// boundaries, after an IRET, and again right after taking an interrupt while others are pending.
+//
+// Mem is the memory type the CPU talks to. BasicCpu<Memory> binds accesses statically (no
+// virtual dispatch); BasicCpu<IMemory> keeps the virtual path for other IMemory backends.
+//
+// With kDecodeCache (needs Memory's code-page tracking) instructions are executed from a
+// pc-indexed cache of decoded records instead of re-reading opcode and immediate each time.
+// Trace is one of the trace policies above.
+template <typename Mem, typename Trace = TextTrace, bool kDecodeCache = std::is_same_v<Mem, Memory>>
+class BasicCpu {
+    struct Regs {
+        uint32_t pc;
+        uint32_t sp;
+        uint32_t acc;
+    };
+
+public:
+    BasicCpu(Mem& mem, InterruptController& ic)
+        : mem_(mem), ic_(ic), pc_(0), sp_(0), acc_(0), halted_(false) {
+        if constexpr (kDecodeCache) cache_ = std::make_unique<DecodeCache>(mem_);
+    }
 
     void Initialize(uint32_t pc, uint32_t sp) {
         pc_ = pc;
@@ -146,12 +1142,50 @@ public:
 
     bool IsHalted() const { return halted_; }
 
+    struct State {
+        uint32_t pc;
+        uint32_t sp;
+        uint32_t acc;
+        bool halted;
+    };
+
+    State SaveState() const { return State{pc_, sp_, acc_, halted_}; }
+
+    void LoadState(const State& st) {
+        pc_ = st.pc;
+        sp_ = st.sp;
+        acc_ = st.acc;
+        halted_ = st.halted;
+    }
+
     void Step() {
-        // 在每条指令执行前检查中断控制器
+        CheckInterrupts();
+        Run(1);
+    }
+
+    // Execute up to max_steps instructions without interrupt checks, stopping early after a
+    // device register write or an IRET. Returns steps executed.
+    // Registers live in a local Regs meanwhile, so guest stores through the byte-addressed
+    // memory cannot force the compiler to reload them after every instruction.
+    uint64_t Run(uint64_t max_steps) {
+        Regs r{pc_, sp_, acc_};
+        uint64_t n = 0;
+        while (n < max_steps && !halted_) {
+            ++n;
+            if (!Execute(r, Fetch(r.pc))) break;
+        }
+        pc_ = r.pc;
+        sp_ = r.sp;
+        acc_ = r.acc;
+        return n;
+    }
+
+    void CheckInterrupts() {
+        if (!ic_.HasPendingEnabled()) return;
         int32_t maybe_irq = ic_.GetPendingEnabledInterrupt();
         if (maybe_irq != -1) {
             uint32_t irq = static_cast<uint32_t>(maybe_irq);
-            if (trace_) std::cout << "[CPU] IRQ " << irq << " taken at pc=" << pc_ << '\n';
+            trace_.Record(kTraceIrq, pc_, irq);
             // 保存 PC 到栈
             Push32(pc_);
             // 跳转到中断向量地址 (假设 irq_id * 4)
@@ -160,87 +1194,115 @@ public:
             ic_.ClearPending(irq);
             // continue to execute the handler instruction at new PC
         }
+    }
 
-        uint8_t opcode = mem_.ReadByte(pc_);
-
-        switch (opcode) {
+    // Returns false when the run must stop early: a store reached a device, or an IRET
+    // returned, after which an interrupt that was left pending can be taken. The controller is
+    // not read here, since other CPUs' threads may write it through IrqDevice mid-quantum.
+    __attribute__((always_inline)) bool Execute(Regs& r, const DecodedInsn& insn) {
+        switch (insn.opcode) {
             case kOpNop: {
-                if (trace_) std::cout << "[CPU] EXEC NOP pc=" << pc_ << '\n';
-                ++pc_;
+                trace_.Record(kOpNop, r.pc);
+                ++r.pc;
                 break;
             }
             case kOpLoadImm: {
-                // 功能模拟: 将接下来的 4 字节立即数加载到 acc_
-                uint32_t imm = mem_.Read32(pc_ + 1);
-                acc_ = imm;
-                if (trace_)
-                    std::cout << "[CPU] EXEC LOAD_IMM pc=" << pc_ << " imm=" << imm
-                              << " -> acc=" << acc_ << '\n';
-                pc_ += 1 + 4;
+                // 功能模拟: 将接下来的 4 字节立即数加载到 acc
+                uint32_t imm = insn.imm;
+                r.acc = imm;
+                trace_.Record(kOpLoadImm, r.pc, imm, r.acc);
+                r.pc += 1 + 4;
                 break;
             }
             case kOpStore: {
-                // 存储 acc_ 到指定地址
-                uint32_t addr = mem_.Read32(pc_ + 1);
-                mem_.Write32(addr, acc_);
-                if (trace_)
-                    std::cout << "[CPU] EXEC STORE pc=" << pc_ << " addr=" << addr
-                              << " value=" << acc_ << '\n';
-                pc_ += 1 + 4;
+                // 存储 acc 到指定地址
+                uint32_t addr = insn.imm;
+                mem_.Write32(addr, r.acc);
+                trace_.Record(kOpStore, r.pc, addr, r.acc);
+                r.pc += 1 + 4;
+                if constexpr (std::is_same_v<Mem, Memory>) {
+                    if (mem_.io_written()) return false;
+                }
                 break;
             }
             case kOpAddImm: {
-                uint32_t imm = mem_.Read32(pc_ + 1);
-                acc_ += imm;
-                if (trace_)
-                    std::cout << "[CPU] EXEC ADD_IMM pc=" << pc_ << " imm=" << imm
-                              << " -> acc=" << acc_ << '\n';
-                pc_ += 1 + 4;
+                uint32_t imm = insn.imm;
+                r.acc += imm;
+                trace_.Record(kOpAddImm, r.pc, imm, r.acc);
+                r.pc += 1 + 4;
                 break;
             }
             case kOpSubImm: {
-                uint32_t imm = mem_.Read32(pc_ + 1);
-                acc_ -= imm;
-                if (trace_)
-                    std::cout << "[CPU] EXEC SUB_IMM pc=" << pc_ << " imm=" << imm
-                              << " -> acc=" << acc_ << '\n';
-                pc_ += 1 + 4;
+                uint32_t imm = insn.imm;
+                r.acc -= imm;
+                trace_.Record(kOpSubImm, r.pc, imm, r.acc);
+                r.pc += 1 + 4;
                 break;
             }
             case kOpJmp: {
-                uint32_t addr = mem_.Read32(pc_ + 1);
-                if (trace_) std::cout << "[CPU] EXEC JMP pc=" << pc_ << " -> " << addr << '\n';
-                pc_ = addr;
+                uint32_t addr = insn.imm;
+                trace_.Record(kOpJmp, r.pc, addr);
+                r.pc = addr;
                 break;
             }
             case kOpPrint: {
-                uint32_t addr = mem_.Read32(pc_ + 1);
+                uint32_t addr = insn.imm;
                 uint32_t v = mem_.Read32(addr);
                 std::cout << "[CPU] PRINT mem[" << addr << "] = " << v << '\n';
-                if (trace_) std::cout << "[CPU] EXEC PRINT pc=" << pc_ << " addr=" << addr << '\n';
-                pc_ += 1 + 4;
+                trace_.Record(kOpPrint, r.pc, addr);
+                r.pc += 1 + 4;
                 break;
             }
             case kOpIret: {
                 // 弹出 PC 并返回
-                uint32_t ret = Pop32();
-                if (trace_) std::cout << "[CPU] EXEC IRET returning to pc=" << ret << '\n';
-                pc_ = ret;
-                break;
+                uint32_t ret = Pop32(r.sp);
+                trace_.Record(kOpIret, r.pc, ret);
+                r.pc = ret;
+                return false;
             }
             case kOpHalt: {
-                if (trace_) std::cout << "[CPU] EXEC HALT pc=" << pc_ << '\n';
+                trace_.Record(kOpHalt, r.pc);
                 halted_ = true;
-                ++pc_;
+                ++r.pc;
                 break;
             }
             default: {
-                std::cerr << "[CPU] Unknown opcode 0x" << std::hex << int(opcode)
-                          << " at pc=" << std::dec << pc_ << '\n';
+                std::cerr << "[CPU] Unknown opcode 0x" << std::hex << int(insn.opcode)
+                          << " at pc=" << std::dec << r.pc << '\n';
                 halted_ = true;
                 break;
             }
         }
+        return true;
+    }
+
+    DecodedInsn Decode(uint32_t pc) {
+        DecodedInsn d{0, mem_.ReadByte(pc), 1};
+        switch (d.opcode) {
+            case kOpLoadImm:
+            case kOpStore:
+            case kOpAddImm:
+            case kOpSubImm:
+            case kOpJmp:
+            case kOpPrint:
+                d.imm = mem_.Read32(pc + 1);
+                d.length = 1 + 4;
+                break;
+            default:
+                break;
+        }
+        return d;
+    }
+
+    __attribute__((always_inline)) DecodedInsn Fetch(uint32_t pc) {
+        if constexpr (kDecodeCache) {
+            if (const DecodedInsn* hit = cache_->Find(pc)) return *hit;
+            DecodedInsn d = Decode(pc);
+            cache_->Insert(pc, d);
+            return d;
+        } else {
+            return Decode(pc);
+        }
     }
 
     // Push/pop helpers (32-bit)
@@ -250,44 +1312,71 @@ public:
         mem_.Write32(sp_, value);
     }
 
-    void SetTrace(bool enable) { trace_ = enable; }
+    void SetTrace(bool enable) { trace_.SetEnabled(enable); }
+    void SetTraceSink(TraceBuffer* sink) { trace_.SetSink(sink); }
+
+    uint32_t Pop32() { return Pop32(sp_); }
 
-    uint32_t Pop32() {
-        uint32_t v = mem_.Read32(sp_);
-        sp_ += 4;
+    uint32_t Pop32(uint32_t& sp) {
+        uint32_t v = mem_.Read32(sp);
+        sp += 4;
         return v;
     }
 
 private:
-    IMemory& mem_;
+    Mem& mem_;
     InterruptController& ic_;
     uint32_t pc_;
     uint32_t sp_;
     uint32_t acc_;  // accumulator / single general register
     bool halted_;
-    bool trace_;
+    Trace trace_;
+    std::unique_ptr<DecodeCache> cache_;  // only with kDecodeCache
 };
 
-// Top-level emulator
+using Cpu = BasicCpu<Memory, EMU_TRACE>;
+
+// Top-level emulator. RAM is [0, memory_size); the peripheral windows live above it.
 class Emulator {
 public:
+    static constexpr uint32_t kTimerBase = 0xF0000000;
+    static constexpr uint32_t kDmaBase = 0xF0001000;
+    static constexpr uint32_t kIrqBase = 0xF0002000;
+    static constexpr uint32_t kGuestTimers = 4;  // timers programmable through kTimerBase
+
     // Non-copyable and non-movable: values bind lifetime to Emulator.
     Emulator(const Emulator&) = delete;
     Emulator& operator=(const Emulator&) = delete;
     Emulator(Emulator&&) = delete;
     Emulator& operator=(Emulator&&) = delete;
 
-    Emulator(uint32_t memory_size, uint32_t irq_count)
-        : mem_(memory_size),
+    Emulator(uint32_t memory_size, uint32_t irq_count, uint32_t dma_channels = 4)
+        : Emulator(nullptr, memory_size, irq_count, dma_channels) {}
+
+    // Start from a shared read-only image; memory pages are copied on first write.
+    Emulator(MemoryImage image, uint32_t memory_size, uint32_t irq_count,
+             uint32_t dma_channels = 4)
+        : mem_(memory_size, std::move(image)),
           ic_(irq_count),
           cpu_(mem_, ic_),
-          dma_(),
-          timer_enabled_(false),
-          timer_(0, 0, ic_) {}
+          dma_(mem_, ic_, events_, dma_channels),
+          dma_dev_(dma_),
+          irq_dev_(ic_),
+          cycles_(0) {
+        cpu_.SetTraceSink(&trace_buf_);
+        for (uint32_t i = 0; i < kGuestTimers; ++i) {
+            timers_.emplace_back(1, 0, ic_, events_);
+            timer_dev_.Attach(&timers_.back());
+        }
+        mem_.MapDevice(kTimerBase, kGuestTimers * 16, &timer_dev_);
+        mem_.MapDevice(kDmaBase, dma_channels * 16, &dma_dev_);
+        mem_.MapDevice(kIrqBase, 16, &irq_dev_);
+    }
 
+    // Timers are cheap: each one only costs a heap entry per period.
     void CreateTimer(uint32_t period_ticks, uint32_t irq_id) {
-        timer_ = Timer(period_ticks, irq_id, ic_);
-        timer_enabled_ = true;
+        timers_.emplace_back(period_ticks, irq_id, ic_, events_);
+        timers_.back().Start(cycles_);
     }
 
     void LoadProgram(const std::vector<uint8_t>& image, uint32_t load_addr) {
@@ -296,35 +1385,600 @@ public:
 
     void InitializeCpu(uint32_t pc, uint32_t sp) { cpu_.Initialize(pc, sp); }
 
+    // Add a secondary CPU sharing memory and devices; returns its index (CPU 0 is the boot
+    // CPU). Interrupts are only delivered to CPU 0.
+    uint32_t AddCpu(uint32_t pc, uint32_t sp) {
+        secondary_.emplace_back(mem_, ic_);
+        secondary_.back().Initialize(pc, sp);
+        return static_cast<uint32_t>(secondary_.size());
+    }
+
+    uint32_t cpu_count() const { return 1 + static_cast<uint32_t>(secondary_.size()); }
+
+    // With more than one CPU, each CPU runs up to quantum instructions before the next one
+    // gets its turn, so CPUs may drift apart by up to one quantum of simulated time. Larger
+    // quanta cost accuracy and buy throughput. Events still fire at their exact tick.
+    void SetQuantum(uint32_t instructions) { quantum_ = instructions ? instructions : 1; }
+
+    // Run the CPUs of each quantum on separate host threads (see Memory::BeginConcurrent()).
+    void SetHostThreads(bool enable) { host_threads_ = enable; }
+
+    // Start an asynchronous DMA; irq_id is raised when the whole list has been copied.
+    bool StartDma(uint32_t channel, std::vector<DmaDescriptor> list, uint32_t irq_id) {
+        return dma_.Start(channel, std::move(list), irq_id, cycles_);
+    }
+
     void EnableCpuTrace(bool enable) { cpu_.SetTrace(enable); }
 
+    // BinaryTrace builds: stream the trace buffer to a file instead of keeping a ring.
+    bool SetTraceFile(const std::string& path) { return trace_buf_.Open(path); }
+    TraceBuffer& trace_buffer() { return trace_buf_; }
+
+    // Time is counted in ticks: tick N happens right before the N-th instruction executes.
+    // With several CPUs, every CPU executes one instruction per tick.
     void Run(uint32_t max_cycles = 100000) {
         ic_.EnableInterrupt(1);  // enable irq 1 for demo; user can change as needed
-        uint32_t cycles = 0;
-        while (!cpu_.IsHalted() && cycles < max_cycles) {
-            if (timer_enabled_) timer_.Tick();
-            cpu_.Step();
-            ++cycles;
+        uint64_t end = cycles_ + max_cycles;
+        if (!secondary_.empty()) {
+            RunQuanta(end);
+        } else {
+            while (!cpu_.IsHalted() && cycles_ < end) {
+                events_.RunDue(cycles_ + 1);
+                cpu_.CheckInterrupts();
+                // Run straight-line until the instruction preceded by the next deadline. With
+                // another interrupt still pending, run only the handler's first instruction so
+                // the next pass takes it too.
+                uint64_t limit = std::min(events_.NextDeadline() - 1, end);
+                if (ic_.HasPendingEnabled()) limit = std::min(limit, cycles_ + 1);
+                cycles_ += cpu_.Run(std::max<uint64_t>(limit - cycles_, 1));
+                // The CPU stops right after a device write; apply it at the current tick.
+                if (mem_.TakeIoWrite()) SyncDevices();
+            }
+        }
+        if (cycles_ >= end) std::cerr << "[Emulator] Reached max cycles\n";
+    }
+
+    uint64_t cycles() const { return cycles_; }
+
+    // Capture CPU registers, interrupt/timer/DMA state (including device writes not yet
+    // applied) and start memory dirty tracking.
+    void Checkpoint() {
+        std::vector<Timer::State> timers;
+        for (const Timer& t : timers_) timers.push_back(t.SaveState());
+        std::vector<Cpu::State> secondary;
+        for (const Cpu& c : secondary_) secondary.push_back(c.SaveState());
+        checkpoint_.emplace(Snapshot{cpu_.SaveState(), std::move(secondary), ic_, events_,
+                                     dma_.SaveState(), std::move(timers),
+                                     timer_dev_.SaveState(), cycles_});
+        mem_.Checkpoint();
+    }
+
+    // Rewind to the last checkpoint; may be called any number of times. Timers and CPUs created
+    // after the checkpoint are dropped.
+    bool Restore() {
+        if (!checkpoint_) return false;
+        const Snapshot& snap = *checkpoint_;
+        mem_.Restore();
+        cpu_.LoadState(snap.cpu);
+        while (secondary_.size() > snap.secondary.size()) secondary_.pop_back();
+        for (size_t i = 0; i < secondary_.size(); ++i) secondary_[i].LoadState(snap.secondary[i]);
+        ic_ = snap.ic;
+        while (timers_.size() > snap.timers.size()) timers_.pop_back();
+        for (size_t i = 0; i < timers_.size(); ++i) timers_[i].LoadState(snap.timers[i]);
+        events_ = snap.events;
+        dma_.LoadState(snap.dma);
+        timer_dev_.LoadState(snap.timer_dev);
+        cycles_ = snap.cycles;
+        return true;
+    }
+
+    // True when every CPU has halted.
+    bool IsHalted() const {
+        for (const Cpu& c : secondary_) {
+            if (!c.IsHalted()) return false;
         }
-        if (cycles >= max_cycles) std::cerr << "[Emulator] Reached max cycles\n";
+        return cpu_.IsHalted();
     }
+    uint32_t SharedMemoryPages() const { return mem_.SharedPages(); }
 
     IMemory& memory() { return mem_; }
     Dma& dma() { return dma_; }
     InterruptController& interrupt_controller() { return ic_; }
 
 private:
+    void SyncDevices() {
+        timer_dev_.Sync(cycles_);
+        dma_dev_.Sync(cycles_);
+    }
+
+    // Run cpu for exactly n instructions unless it halts; returns the instructions executed.
+    // Device writes end Cpu::Run() early; with several CPUs their side effects wait for the end
+    // of the quantum.
+    static uint64_t RunFor(Cpu& cpu, uint64_t n) {
+        uint64_t done = 0;
+        while (done < n && !cpu.IsHalted()) done += cpu.Run(n - done);
+        return done;
+    }
+
+    // Multi-CPU loop: between quanta everything is single-threaded (events, interrupts, device
+    // syncs, code invalidation); inside a quantum only CPUs run.
+    void RunQuanta(uint64_t end) {
+        QuantumWorkers workers(*this);
+        while (!IsHalted() && cycles_ < end) {
+            events_.RunDue(cycles_ + 1);
+            cpu_.CheckInterrupts();
+            uint64_t limit = std::min({events_.NextDeadline() - 1, end, cycles_ + quantum_});
+            if (ic_.HasPendingEnabled()) limit = std::min(limit, cycles_ + 1);
+            uint64_t slice = std::max<uint64_t>(limit - cycles_, 1);
+            // Time advances by the longest run; it is shorter than slice only if all CPUs halted.
+            uint64_t ran = 0;
+            if (workers.active()) {
+                ran = workers.Run(slice);
+                mem_.FlushDeferredCode();
+            } else {
+                ran = RunFor(cpu_, slice);
+                for (Cpu& c : secondary_) ran = std::max(ran, RunFor(c, slice));
+            }
+            cycles_ += ran;
+            if (mem_.TakeIoWrite()) SyncDevices();
+        }
+    }
+
+    // One host thread per secondary CPU for the duration of a Run(); the caller runs CPU 0.
+    // Quantum boundaries are spin barriers on a generation counter, which are far cheaper
+    // than a condition variable at quanta of a few microseconds.
+    class QuantumWorkers {
+    public:
+        explicit QuantumWorkers(Emulator& emu) : emu_(emu), ran_(emu.secondary_.size()) {
+            if (!emu_.host_threads_) return;
+            emu_.mem_.BeginConcurrent();
+            for (size_t i = 0; i < emu_.secondary_.size(); ++i) {
+                threads_.emplace_back([this, i] { Work(emu_.secondary_[i], ran_[i]); });
+            }
+        }
+
+        ~QuantumWorkers() {
+            if (!active()) return;
+            stop_.store(true, std::memory_order_relaxed);
+            generation_.fetch_add(1, std::memory_order_release);
+            for (std::thread& t : threads_) t.join();
+            emu_.mem_.EndConcurrent();
+        }
+
+        QuantumWorkers(const QuantumWorkers&) = delete;
+        QuantumWorkers& operator=(const QuantumWorkers&) = delete;
+
+        bool active() const { return !threads_.empty(); }
+
+        // Returns the most instructions any CPU executed.
+        uint64_t Run(uint64_t slice) {
+            slice_ = slice;
+            done_.store(0, std::memory_order_relaxed);
+            generation_.fetch_add(1, std::memory_order_release);
+            uint64_t ran = RunFor(emu_.cpu_, slice);
+            while (done_.load(std::memory_order_acquire) != threads_.size()) {
+                std::this_thread::yield();
+            }
+            for (const Ran& r : ran_) ran = std::max(ran, r.n);
+            return ran;
+        }
+
+    private:
+        // Per-thread result, published by the done_ release; padded against false sharing.
+        struct alignas(64) Ran {
+            uint64_t n = 0;
+        };
+
+        void Work(Cpu& cpu, Ran& ran) {
+            uint64_t seen = 0;
+            for (;;) {
+                uint64_t g;
+                while ((g = generation_.load(std::memory_order_acquire)) == seen) {
+                    std::this_thread::yield();
+                }
+                seen = g;
+                if (stop_.load(std::memory_order_relaxed)) return;
+                ran.n = RunFor(cpu, slice_);
+                done_.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        Emulator& emu_;
+        std::vector<Ran> ran_;
+        std::vector<std::thread> threads_;
+        uint64_t slice_ = 0;  // published by the generation_ release
+        std::atomic<uint64_t> generation_{0};
+        std::atomic<size_t> done_{0};
+        std::atomic<bool> stop_{false};
+    };
+
+    TraceBuffer trace_buf_;  // declared first: outlives the CPU that writes to it
     Memory mem_;
     InterruptController ic_;
     Cpu cpu_;
+    std::deque<Cpu> secondary_;  // CPUs 1..n
+    uint32_t quantum_ = 1000;
+    bool host_threads_ = false;
+    EventQueue events_;
     Dma dma_;
-    bool timer_enabled_;
-    Timer timer_;
+    std::deque<Timer> timers_;  // deque keeps addresses stable for the event queue and devices
+    TimerDevice timer_dev_;
+    DmaDevice dma_dev_;
+    IrqDevice irq_dev_;
+    uint64_t cycles_;
+
+    struct Snapshot {
+        Cpu::State cpu;
+        std::vector<Cpu::State> secondary;
+        InterruptController ic;
+        EventQueue events;  // timer deadlines and in-flight DMA chunks
+        std::vector<Dma::ChannelState> dma;
+        std::vector<Timer::State> timers;
+        std::vector<uint8_t> timer_dev;  // latched guest timer starts
+        uint64_t cycles;
+    };
+    std::optional<Snapshot> checkpoint_;
+};
+
+// ParallelRunner: runs many independent emulators built from one shared read-only image on a
+// set of worker threads, each pinned to one of the CPUs the caller may run on. Instances share
+// nothing mutable, so throughput scales with cores; results are collected per seed.
+struct InstanceResult {
+    uint32_t seed;
+    uint64_t cycles;
+    bool halted;
+    uint32_t value;         // whatever the probe extracted, e.g. a memory word
+    uint32_t shared_pages;  // memory pages never copied out of the image
+};
+
+class ParallelRunner {
+public:
+    struct Config {
+        uint32_t memory_size;
+        uint32_t irq_count;
+        uint32_t entry_pc;
+        uint32_t stack_top;
+        uint32_t max_cycles;
+    };
+
+    using Setup = std::function<void(Emulator&, uint32_t seed)>;
+    using Probe = std::function<uint32_t(Emulator&)>;
+
+    ParallelRunner(MemoryImage image, const Config& cfg, unsigned threads = 0)
+        : image_(std::move(image)),
+          cfg_(cfg),
+          threads_(threads ? threads : DefaultThreads()) {}
+
+    unsigned threads() const { return threads_; }
+
+    // Workers of the last Run() that could be pinned to a CPU.
+    unsigned pinned() const { return pinned_; }
+
+    // Run seeds [first_seed, first_seed + count). setup configures an instance (timers, IRQs)
+    // before it runs; probe extracts its result afterwards. All instances run on pool threads;
+    // the calling thread only waits, so its affinity is left as it was.
+    std::vector<InstanceResult> Run(uint32_t first_seed,
+                                    uint32_t count,
+                                    const Setup& setup,
+                                    const Probe& probe) {
+        std::vector<InstanceResult> results(count);
+        std::vector<int> cpus = AllowedCpus();
+        std::atomic<uint32_t> next{0};
+        std::atomic<unsigned> pinned{0};
+        auto worker = [&](unsigned index) {
+            if (!cpus.empty() && PinTo(cpus[index % cpus.size()])) pinned.fetch_add(1);
+            for (uint32_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                uint32_t seed = first_seed + i;
+                Emulator emu(image_, cfg_.memory_size, cfg_.irq_count);
+                setup(emu, seed);
+                emu.InitializeCpu(cfg_.entry_pc, cfg_.stack_top);
+                emu.Run(cfg_.max_cycles);
+                results[i] = InstanceResult{seed, emu.cycles(), emu.IsHalted(), probe(emu),
+                                            emu.SharedMemoryPages()};
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads_; ++t) pool.emplace_back(worker, t);
+        for (std::thread& t : pool) t.join();
+        pinned_ = pinned.load();
+        return results;
+    }
+
+private:
+    // CPUs in the calling thread's affinity mask (cpusets, taskset), in ascending order.
+    static std::vector<int> AllowedCpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    static unsigned DefaultThreads() {
+        size_t cpus = AllowedCpus().size();
+        if (cpus) return static_cast<unsigned>(cpus);
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    static bool PinTo(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    MemoryImage image_;
+    Config cfg_;
+    unsigned threads_;
+    unsigned pinned_ = 0;
 };
 
-// (no helper functions needed)
+// Demo for the runner: fuzz the timer period and record acc at the moment IRQ 1 is taken.
+// The image spans 16 pages; an instance only writes page 0 (the result word) and the stack
+// page at the top, so the other 14 should stay shared with the image.
+static void RunMulti(uint32_t count, unsigned threads) {
+    constexpr uint32_t kMemSize = 16 * Memory::kPageSize;
+    auto image = std::make_shared<std::vector<uint8_t>>(kMemSize, 0);
+    uint32_t p = 0;
+    auto emit = [&](uint8_t op, uint32_t imm) {
+        (*image)[p++] = op;
+        std::memcpy(&(*image)[p], &imm, sizeof(imm));
+        p += 4;
+    };
+    // IRQ 1 handler at 4: STORE 204; HALT
+    p = 4;
+    emit(kOpStore, 204);
+    (*image)[p++] = kOpHalt;
+    // main at 100: LOAD_IMM 0; loop: ADD_IMM 3; JMP loop
+    p = 100;
+    emit(kOpLoadImm, 0);
+    emit(kOpAddImm, 3);
+    emit(kOpJmp, 105);
+
+    ParallelRunner runner(image, {kMemSize, 8, 100, kMemSize, 1000000}, threads);
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<InstanceResult> results = runner.Run(
+        0,
+        count,
+        [](Emulator& emu, uint32_t seed) { emu.CreateTimer(10000 + seed * 7919 % 90000, 1); },
+        [](Emulator& emu) { return emu.memory().Read32(204); });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    uint64_t cycles = 0;
+    uint32_t halted = 0;
+    uint32_t max_value = 0;
+    uint32_t min_shared = kMemSize / Memory::kPageSize;
+    for (const InstanceResult& r : results) {
+        cycles += r.cycles;
+        halted += r.halted;
+        max_value = std::max(max_value, r.value);
+        min_shared = std::min(min_shared, r.shared_pages);
+    }
+    std::cout << "[Multi] " << count << " instances on " << runner.threads() << " threads ("
+              << runner.pinned() << " pinned): "
+              << halted << " halted, max acc at IRQ " << max_value << ", at least " << min_shared
+              << " of " << kMemSize / Memory::kPageSize << " pages still shared, "
+              << cycles / secs / 1e6 << " M cycles/s\n";
+}
+
+// Demo for checkpoints: rewind a running guest many times and check it replays identically.
+static void RunRewind(uint32_t rounds) {
+    constexpr uint32_t kMemSize = 64 * 1024;
+    Emulator emu(kMemSize, 8);
+    std::vector<uint8_t> image(256, 0);
+    uint32_t p = 100;
+    auto emit = [&](uint8_t op, uint32_t imm) {
+        image[p++] = op;
+        std::memcpy(&image[p], &imm, sizeof(imm));
+        p += 4;
+    };
+    // main at 100: LOAD_IMM 0; loop: ADD_IMM 1; STORE 8192; JMP loop. IRQ 1 at 4: HALT
+    emit(kOpLoadImm, 0);
+    emit(kOpAddImm, 1);
+    emit(kOpStore, 8192);
+    emit(kOpJmp, 105);
+    image[4] = kOpHalt;
+    emu.LoadProgram(image, 0);
+    emu.InitializeCpu(100, kMemSize);
+    emu.CreateTimer(6000, 1);
+
+    emu.Run(1000);
+    emu.Checkpoint();
+    emu.Run();
+    uint32_t expected = emu.memory().Read32(8192);
+    uint64_t expected_cycles = emu.cycles();
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < rounds; ++i) {
+        emu.Restore();
+        emu.Run();
+        mismatches += emu.memory().Read32(8192) != expected || emu.cycles() != expected_cycles;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "[Rewind] " << rounds << " restore+replay rounds, " << mismatches
+              << " mismatches, " << rounds / secs << " rounds/s\n";
+}
+
+// Demo for the device bus: the guest programs the IRQ controller, a timer and a DMA channel
+// purely through MMIO stores, then spins until the DMA-done interrupt halts it.
+static void RunMmio() {
+    constexpr uint32_t kMemSize = 1024;
+    Emulator emu(kMemSize, 8);
+    std::vector<uint8_t> image(256, 0);
+    uint32_t p = 100;
+    auto emit = [&](uint8_t op, uint32_t imm) {
+        image[p++] = op;
+        std::memcpy(&image[p], &imm, sizeof(imm));
+        p += 4;
+    };
+    auto write_reg = [&](uint32_t addr, uint32_t value) {
+        emit(kOpLoadImm, value);
+        emit(kOpStore, addr);
+    };
+    write_reg(Emulator::kIrqBase + 0x0, 2);  // enable DMA-done irq
+    write_reg(Emulator::kIrqBase + 0x0, 3);  // enable timer irq
+    write_reg(Emulator::kTimerBase + 0x0, 3);
+    write_reg(Emulator::kTimerBase + 0x4, 3);
+    write_reg(Emulator::kTimerBase + 0x8, 1);
+    write_reg(Emulator::kDmaBase + 0x0, 500);  // one descriptor at 500
+    write_reg(Emulator::kDmaBase + 0x4, 1);
+    write_reg(Emulator::kDmaBase + 0x8, 2);
+    write_reg(Emulator::kDmaBase + 0xC, 1);
+    write_reg(Emulator::kDmaBase + 0x14, 0xFFFFFFFF);  // channel 1: bogus count is rejected
+    write_reg(Emulator::kDmaBase + 0x1C, 1);
+    uint32_t loop = p;
+    image[p++] = kOpNop;
+    emit(kOpJmp, loop);
+    image[8] = kOpHalt;   // irq 2
+    image[12] = kOpIret;  // irq 3
+    emu.LoadProgram(image, 0);
+    IMemory& mem = emu.memory();
+    mem.Write32(500, 600);
+    mem.Write32(504, 700);
+    mem.Write32(508, 32);
+    for (uint32_t i = 0; i < 32; ++i) mem.WriteByte(600 + i, static_cast<uint8_t>(i * 7 + 1));
+    emu.InitializeCpu(100, kMemSize);
+    emu.Run();
+
+    bool same = true;
+    for (uint32_t i = 0; i < 32; ++i) same &= mem.ReadByte(700 + i) == mem.ReadByte(600 + i);
+    std::cout << "[MMIO] halted=" << emu.IsHalted() << " cycles=" << emu.cycles()
+              << " dma copy " << (same ? "ok" : "MISMATCH")
+              << ", bad start ctrl=" << mem.Read32(Emulator::kDmaBase + 0x1C)
+              << ", timer running=" << mem.Read32(Emulator::kTimerBase + 0x8) << '\n';
+}
+
+// Demo for multiple CPUs: every CPU counts in its own loop; the timer IRQ on CPU 0 patches
+// the secondaries' JMPs into HALTs and halts CPU 0. Counts differ by at most about a quantum.
+static void RunSmp(uint32_t cpus, uint32_t quantum, bool threads) {
+    constexpr uint32_t kMemSize = 64 * 1024;
+    constexpr uint32_t kPeriod = 20000000;
+    Emulator emu(kMemSize, 8);
+    std::vector<uint8_t> image(4096, 0);
+    uint32_t p = 0;
+    auto emit = [&](uint8_t op, uint32_t imm) {
+        image[p++] = op;
+        std::memcpy(&image[p], &imm, sizeof(imm));
+        p += 4;
+    };
+    // CPU i at 1024 + 32 * i: LOAD_IMM 0; loop: ADD_IMM 1; STORE 8192 + 4 * i; JMP loop
+    std::vector<uint32_t> jmp_at(cpus);
+    for (uint32_t i = 0; i < cpus; ++i) {
+        p = 1024 + 32 * i;
+        emit(kOpLoadImm, 0);
+        emit(kOpAddImm, 1);
+        emit(kOpStore, 8192 + 4 * i);
+        jmp_at[i] = p;
+        emit(kOpJmp, jmp_at[i] - 10);
+    }
+    // IRQ 1 at 4: JMP 256. 256: { LOAD_IMM HALT; STORE jmp_at[i] } for each secondary; HALT
+    p = 4;
+    emit(kOpJmp, 256);
+    p = 256;
+    for (uint32_t i = 1; i < cpus; ++i) {
+        emit(kOpLoadImm, kOpHalt);
+        emit(kOpStore, jmp_at[i]);
+    }
+    image[p++] = kOpHalt;
+    emu.LoadProgram(image, 0);
+    emu.InitializeCpu(1024, kMemSize);
+    for (uint32_t i = 1; i < cpus; ++i) emu.AddCpu(1024 + 32 * i, kMemSize - 1024 * i);
+    emu.SetQuantum(quantum);
+    emu.SetHostThreads(threads);
+    emu.CreateTimer(kPeriod, 1);
+
+    auto t0 = std::chrono::steady_clock::now();
+    emu.Run(kPeriod + 10 * quantum);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "[SMP] " << cpus << " cpus, quantum " << quantum << (threads ? ", threaded" : "")
+              << ": halted=" << emu.IsHalted() << " counts";
+    for (uint32_t i = 0; i < cpus; ++i) std::cout << ' ' << emu.memory().Read32(8192 + 4 * i);
+    std::cout << ", " << emu.cycles() * cpus / secs / 1e6 << " M insns/s\n";
+}
+
+// Benchmark: run a tight ADD/JMP loop through the CPU variants and report cycles/sec.
+// noinline: each variant gets its own loop instead of sharing RunBenchmark's registers.
+template <typename Mem, typename Trace, bool kDecodeCache>
+__attribute__((noinline)) static double BenchCpu(Mem& mem, InterruptController& ic, uint64_t steps,
+                       TraceBuffer* sink = nullptr) {
+    BasicCpu<Mem, Trace, kDecodeCache> cpu(mem, ic);
+    cpu.Initialize(0, 0);
+    if (sink) {
+        cpu.SetTraceSink(sink);
+        cpu.SetTrace(true);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    cpu.Run(steps);
+    auto t1 = std::chrono::steady_clock::now();
+    return steps / std::chrono::duration<double>(t1 - t0).count();
+}
+
+static void RunBenchmark() {
+    constexpr uint64_t kSteps = 50000000;
+    Memory mem(1024);
+    InterruptController ic(8);
+    // 0: LOAD_IMM 0; 5: ADD_IMM 1; 10: JMP 5
+    uint32_t p = 0;
+    auto emit = [&](uint8_t op, uint32_t imm) {
+        mem.WriteByte(p++, op);
+        mem.Write32(p, imm);
+        p += 4;
+    };
+    emit(kOpLoadImm, 0);
+    emit(kOpAddImm, 1);
+    emit(kOpJmp, 5);
+
+    TraceBuffer ring;
+    auto report = [](const char* name, double rate, double base) {
+        std::cout << "[Bench] " << name << rate / 1e6 << " M cycles/s (" << rate / base << "x)\n";
+    };
+    double virt = BenchCpu<IMemory, NoTrace, false>(mem, ic, kSteps);
+    report("BasicCpu<IMemory>:                  ", virt, virt);
+    report("BasicCpu<Memory>, decode:           ",
+           BenchCpu<Memory, NoTrace, false>(mem, ic, kSteps), virt);
+    report("BasicCpu<Memory>, cached:           ",
+           BenchCpu<Memory, NoTrace, true>(mem, ic, kSteps), virt);
+    report("BasicCpu<Memory>, text trace off:   ",
+           BenchCpu<Memory, TextTrace, true>(mem, ic, kSteps), virt);
+    report("BasicCpu<Memory>, binary trace on:  ",
+           BenchCpu<Memory, BinaryTrace, true>(mem, ic, kSteps, &ring), virt);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "bench") == 0) {
+        RunBenchmark();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "multi") == 0) {
+        RunMulti(argc > 2 ? std::atoi(argv[2]) : 1000, argc > 3 ? std::atoi(argv[3]) : 0);
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "rewind") == 0) {
+        RunRewind(argc > 2 ? std::atoi(argv[2]) : 10000);
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "smp") == 0) {
+        RunSmp(argc > 2 ? std::max(1, std::atoi(argv[2])) : 4,
+               argc > 3 ? std::atoi(argv[3]) : 1000,
+               argc > 4 && std::atoi(argv[4]) != 0);
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "mmio") == 0) {
+        RunMmio();
+        return 0;
+    }
+    if (argc > 2 && std::strcmp(argv[1], "trace-dump") == 0) {
+        if (!TraceBuffer::Print(argv[2], std::cout)) {
+            std::cerr << "[Main] " << argv[2] << " is not a trace file\n";
+            return 1;
+        }
+        return 0;
+    }
 
-int main() {
     constexpr uint32_t kMemSize = 1024;
     constexpr uint32_t kStackTop = kMemSize;  // stack grows down from top
 
@@ -333,7 +1987,9 @@ int main() {
     // Create a timer that triggers IRQ 1 every 5 ticks
     emu.CreateTimer(5, 1);
 
-    // Enable CPU trace for demo
+    // Enable CPU trace for demo. A BinaryTrace build writes it to emu_trace.bin instead; view
+    // it with "emu trace-dump emu_trace.bin".
+    if (std::is_same_v<EMU_TRACE, BinaryTrace>) emu.SetTraceFile("emu_trace.bin");
     emu.EnableCpuTrace(true);
 
     // Build a small memory image.
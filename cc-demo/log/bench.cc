@@ -0,0 +1,274 @@
+// xlog_bench - 日志吞吐和调用延迟测试
+//
+// 1..N 个线程各写 n 条短消息或长消息, 统计每秒写出的条数和单次调用延迟的 p50/p99/p999,
+// 会丢日志的后端 (log.h) 另外给出丢弃条数。
+// 输出目标: /dev/null, tmpfs 文件 (/dev/shm), 磁盘文件。
+//
+// 所有后端都写标准输出 (fd 1), 每轮测试前把目标文件 dup2 到 fd 1, 结果表打印到原来的标准输出。
+// 新后端用 RegisterBackend 注册即可参与测试。
+//
+// 用法: xlog_bench [-t 最大线程数] [-n 每线程条数] [-b 后端名子串] [-o 目标名] [-d 磁盘目录]
+//   ./xlog_bench -t 4 -n 100000
+//   ./xlog_bench -b xlog -o tmpfs
+
+#include "xlog.h"
+
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// util/log.h 定义了名为 log 的宏, 放在所有标准库头文件之后
+#include "util/log.h"
+
+namespace {
+
+// 长消息的正文, 约 160 字节
+const char* kLongText =
+    "the quick brown fox jumps over the lazy dog; pack my box with five dozen liquor jugs; "
+    "sphinx of black quartz, judge my vow; how vexingly quick daft zebras jump";
+
+struct Backend {
+    const char* name;
+    void (*start)();   // 每轮开始前配置
+    void (*finish)();  // 每轮结束: 等待日志全部写出并恢复默认配置
+    void (*shortMsg)(int thread, long i);
+    void (*longMsg)(int thread, long i);
+    unsigned long (*dropped)();  // 累计丢弃的条数, 不会丢日志的后端为 nullptr
+};
+
+std::vector<Backend>& Backends() {
+    static std::vector<Backend> backends;
+    return backends;
+}
+
+struct RegisterBackend {
+    explicit RegisterBackend(const Backend& b) { Backends().push_back(b); }
+};
+
+void Nop() {}
+
+// xlog 的四种模式
+void XlogShort(int thread, long i) { XLOG_INFO("short msg thread=%d i=%ld", thread, i); }
+void XlogLong(int thread, long i) {
+    XLOG_INFO("long msg thread=%d i=%ld value=%.3f text=%s", thread, i, i * 0.5, kLongText);
+}
+
+RegisterBackend xlogSync({"xlog-sync", Nop, Nop, XlogShort, XlogLong, nullptr});
+RegisterBackend xlogAsync({"xlog-async", [] { XLOG_ENABLE_ASYNC(true); },
+                           [] { XLOG_FLUSH(); XLOG_ENABLE_ASYNC(false); }, XlogShort, XlogLong, nullptr});
+RegisterBackend xlogDeferred({"xlog-deferred", [] { XLOG_ENABLE_DEFERRED(true); },
+                              [] { XLOG_FLUSH(); XLOG_ENABLE_DEFERRED(false); }, XlogShort, XlogLong, nullptr});
+RegisterBackend xlogBuffered({"xlog-buffered", [] { XLOG_ENABLE_BUFFERED(true); },
+                              [] { XLOG_FLUSH(); XLOG_ENABLE_BUFFERED(false); }, XlogShort, XlogLong, nullptr});
+
+// common/util/log.h 的 log() 宏: 缓冲区满时丢弃, 丢弃数见 drop 列
+RegisterBackend clog({"c-log", Nop, log_flush,
+                      [](int thread, long i) { log("short msg thread=%d i=%ld", thread, i); },
+                      [](int thread, long i) {
+                          log("long msg thread=%d i=%ld value=%.3f text=%s", thread, i, i * 0.5, kLongText);
+                      },
+                      [] { return __atomic_load_n(&log_state_.dropped_total, __ATOMIC_RELAXED); }});
+
+// 对照组: snprintf + 每条一次 write
+RegisterBackend rawWrite({"raw-write", Nop, Nop,
+                          [](int thread, long i) {
+                              char buf[64];
+                              int n = snprintf(buf, sizeof(buf), "short msg thread=%d i=%ld\n", thread, i);
+                              if (write(STDOUT_FILENO, buf, n) < 0) {
+                                  abort();
+                              }
+                          },
+                          [](int thread, long i) {
+                              char buf[512];
+                              int n = snprintf(buf, sizeof(buf), "long msg thread=%d i=%ld value=%.3f text=%s\n",
+                                               thread, i, i * 0.5, kLongText);
+                              if (write(STDOUT_FILENO, buf, n) < 0) {
+                                  abort();
+                              }
+                          },
+                          nullptr});
+
+struct Target {
+    std::string name;
+    std::string path;
+    bool remove;  // 结束后删除
+};
+
+struct Result {
+    double msgsPerSec;
+    unsigned long dropped;
+    uint32_t p50, p99, p999;
+};
+
+uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 一轮测试: threads 个线程各写 count 条, 计时到 finish 返回 (日志全部写出) 为止
+Result RunOnce(const Backend& b, bool longMsg, int threads, long count) {
+    std::vector<std::vector<uint32_t>> latency(threads);
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    auto emit = longMsg ? b.longMsg : b.shortMsg;
+
+    unsigned long dropped = b.dropped ? b.dropped() : 0;
+    b.start();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::vector<uint32_t>& lat = latency[t];
+            lat.resize(count);
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (long i = 0; i < count; ++i) {
+                uint64_t begin = NowNs();
+                emit(t, i);
+                uint64_t ns = NowNs() - begin;
+                lat[i] = static_cast<uint32_t>(std::min<uint64_t>(ns, UINT32_MAX));
+            }
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    uint64_t begin = NowNs();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        w.join();
+    }
+    b.finish();
+    uint64_t elapsed = NowNs() - begin;
+
+    std::vector<uint32_t> all;
+    all.reserve(threads * count);
+    for (auto& lat : latency) {
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    auto pct = [&all](double p) {
+        size_t k = std::min(all.size() - 1, static_cast<size_t>(p * all.size()));
+        std::nth_element(all.begin(), all.begin() + k, all.end());
+        return all[k];
+    };
+    Result r;
+    r.dropped = b.dropped ? b.dropped() - dropped : 0;
+    r.msgsPerSec = (threads * count - r.dropped) * 1e9 / elapsed;
+    r.p50 = pct(0.50);
+    r.p99 = pct(0.99);
+    r.p999 = pct(0.999);
+    return r;
+}
+
+// 两次读时钟本身的开销, 计入了每个延迟样本
+uint64_t ClockOverhead() {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t a = NowNs();
+        uint64_t b = NowNs();
+        best = std::min(best, b - a);
+    }
+    return best;
+}
+
+void Usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-t max_threads] [-n msgs_per_thread] [-b backend] [-o null|tmpfs|disk] [-d disk_dir]\n",
+            prog);
+    fprintf(stderr, "backends:");
+    for (auto& b : Backends()) {
+        fprintf(stderr, " %s", b.name);
+    }
+    fprintf(stderr, "\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int maxThreads = 4;
+    long count = 100000;
+    std::string backendFilter;
+    std::string targetFilter;
+    std::string diskDir = ".";
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:b:o:d:h")) != -1) {
+        switch (opt) {
+        case 't': maxThreads = std::max(1, atoi(optarg)); break;
+        case 'n': count = std::max(1L, atol(optarg)); break;
+        case 'b': backendFilter = optarg; break;
+        case 'o': targetFilter = optarg; break;
+        case 'd': diskDir = optarg; break;
+        default: Usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<int> threadCounts;  // 1, 2, 4, ..., maxThreads
+    for (int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::vector<Target> targets = {{"null", "/dev/null", false}};
+    struct stat st;
+    if (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode)) {
+        targets.push_back({"tmpfs", "/dev/shm/xlog_bench.log", true});
+    }
+    targets.push_back({"disk", diskDir + "/xlog_bench.log", true});
+
+    // 结果写到原来的标准输出, fd 1 留给被测的日志
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report) {
+        perror("dup");
+        return 1;
+    }
+
+    XLOG_SET_LEVEL(xlog::LogLevel::Info);
+    XLOG_ENABLE_TIMESTAMP(true);  // 与 log() 一样带时间戳
+
+    fprintf(report, "%ld msgs/thread, latency in ns (includes ~%llu ns clock overhead)\n", count,
+            static_cast<unsigned long long>(ClockOverhead()));
+    fprintf(report, "%-6s %-14s %-5s %3s %12s %8s %8s %8s %8s\n", "target", "backend", "msg", "thr", "msgs/s",
+            "p50", "p99", "p999", "drop");
+    fflush(report);
+
+    for (const Target& target : targets) {
+        if (!targetFilter.empty() && target.name != targetFilter) {
+            continue;
+        }
+        int fd = open(target.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fprintf(report, "%-6s open %s: %s\n", target.name.c_str(), target.path.c_str(), strerror(errno));
+            continue;
+        }
+        dup2(fd, STDOUT_FILENO);
+        for (const Backend& b : Backends()) {
+            if (!backendFilter.empty() && std::string(b.name).find(backendFilter) == std::string::npos) {
+                continue;
+            }
+            for (bool longMsg : {false, true}) {
+                for (int threads : threadCounts) {
+                    if (ftruncate(STDOUT_FILENO, 0) < 0 && errno != EINVAL) {
+                        perror("ftruncate");
+                    }
+                    Result r = RunOnce(b, longMsg, threads, count);
+                    fprintf(report, "%-6s %-14s %-5s %3d %12.0f %8u %8u %8u %8lu\n", target.name.c_str(), b.name,
+                            longMsg ? "long" : "short", threads, r.msgsPerSec, r.p50, r.p99, r.p999, r.dropped);
+                    fflush(report);
+                }
+            }
+        }
+        close(fd);
+        if (target.remove) {
+            unlink(target.path.c_str());
+        }
+    }
+    return 0;
+}
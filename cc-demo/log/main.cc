@@ -1,10 +1,51 @@
 #include "xlog.h"
 
+#include <thread>
+#include <vector>
+
 int main() {
     XLOG_SET_LEVEL(xlog::LogLevel::Error);
     XLOG_ENABLE_TIMESTAMP(true);
     XLOG_INFO("Hello, %s!", "world");
     XLOG_ERROR("Hello, %s!!", "world");
+
+    // 异步模式: 多个线程并发写日志, 后台线程批量输出
+    XLOG_ENABLE_ASYNC(true);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 3; ++i) {
+                XLOG_ERROR("async thread %d message %d", t, i);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    XLOG_FLUSH();
+    XLOG_ENABLE_ASYNC(false);
+
+    // 延迟格式化模式: 写二进制日志, 再离线解码
+    XLOG_ENABLE_DEFERRED(true);
+    XLOG_SET_BINARY_FILE("a.xlog");
+    XLOG_ERROR("deferred %s: int=%d hex=%#x double=%.2f", "binary", -5, 255u, 3.14159);
+    XLOG_FLUSH();
+    XLOG_ENABLE_DEFERRED(false);
+    xlog::Logger::DecodeBinaryLog("a.xlog", std::cout);
+
+    // 线程缓冲模式: 每个线程攒一批再由后台线程 writev 写出
+    XLOG_ENABLE_BUFFERED(true);
+    XLOG_ERROR("buffered %d", 1);
+    XLOG_ERROR("buffered %d", 2);
+    XLOG_FLUSH();
+    XLOG_ENABLE_BUFFERED(false);
+
+    // 热路径限流: 1000 次调用只输出 3 + 3 条
+    for (int i = 0; i < 1000; ++i) {
+        XLOG_ERROR_EVERY_N(400, "every_n %d", i);
+        XLOG_ERROR_FIRST_N(3, "first_n %d", i);
+    }
+
     XLOG_SET_FILE("a.log");
     XLOG_ERROR("Hello, %s!!", "world");
     return 0;
@@ -24,6 +24,25 @@
 //    xlog::Logger::EnableTimestamp(true);
 //    XLOG_ENABLE_TIMESTAMP(false); // 使用宏
 //
+//    // 异步模式: 调用线程只格式化消息并放入无锁队列, 由后台线程批量写出。默认关闭。
+//    xlog::Logger::SetAsync(true);
+//    XLOG_ENABLE_ASYNC(true); // 使用宏
+//    XLOG_FLUSH();            // 等待已提交的日志全部写出
+//
+//    // 延迟格式化模式: 调用线程只把格式串指针和原始参数拷贝进本线程的缓冲区,
+//    // 由后台线程格式化; 也可以直接写成二进制文件, 之后离线解码。默认关闭。
+//    XLOG_ENABLE_DEFERRED(true);
+//    XLOG_SET_BINARY_FILE("app.xlog");  // 可选: 写二进制日志
+//    xlog::Logger::DecodeBinaryLog("app.xlog", std::cout);  // 离线解码
+//
+//    // 线程缓冲模式: 每个线程把格式化好的行攒在自己的缓冲区里, 缓冲区写满或超过
+//    // 延迟上限时交给后台线程, 多个缓冲区用一次 writev 写出。默认关闭。
+//    xlog::Logger::SetBuffered(true, std::chrono::milliseconds(50));
+//    XLOG_ENABLE_BUFFERED(true); // 使用宏, 延迟上限默认 100ms
+//
+//    // 滚动日志文件 app.0.log, app.1.log, ...: 每个最大 64MB, 最长 1 小时, 保留 10 个
+//    XLOG_SET_ROLLING_FILE("app", 64 << 20, 3600, 10);
+//
 // 3. 记录日志:
 //    // 使用带换行的日志宏 (支持 printf 风格格式化)
 //    XLOG_ERROR("发生了一个错误，错误码: %d", errorCode);
@@ -34,10 +53,36 @@
 //    XLOG_INFO_RAW("处理进度: ");
 //    XLOG_INFO("50%%..."); // 在同一行继续输出
 //
+// 4. 热路径限流 (每个调用点独立计数, 不加锁):
+//    XLOG_INFO_EVERY_N(1000, "第 %d 个包", n);    // 每 1000 次输出一次
+//    XLOG_ERROR_FIRST_N(5, "校验失败: %d", err);  // 只输出前 5 次
+//    XLOG_INFO_RATE(10, "队列满, 长度 %zu", len); // 平均每秒最多 10 条
+//    // 被丢弃的条数在该调用点下一次输出时汇报: "file.cc:42: suppressed 12345 messages"
+//
+// 5. 编译期等级 (可选):
+//    // 低于 XLOG_MIN_LEVEL 的 XLOG_* 调用连同参数求值一起被编译掉。
+//    // 0 Debug, 1 Info, 2 Error, 3 全部关闭; 默认定义了 NDEBUG 时为 1, 否则为 0。
+//    g++ -DXLOG_MIN_LEVEL=2 ...
+//
 // 注意:
 // - 仅支持 Linux 平台 (因为使用了 localtime_r)。
+// - 时间戳使用 common/util/timestamp.h, 编译时需要 -I<repo>/common。
 // - 日志输出目标 (屏幕/文件) 一旦设置为文件后，无法再切换回屏幕。
-// - 使用 printf 风格格式化时，请确保参数类型与格式字符串匹配。
+// - 滚动日志文件预分配并 mmap 写入, 正在写的文件尾部是 0 字节, 切换或退出时才截断到实际长度。
+//   进程崩溃留下的 0 字节尾部在下次以同一 base 启动时截掉, 旧文件也计入保留个数。
+//   按时间切分在到期后的第一次写入时发生。
+// - 使用 printf 风格格式化时，请确保参数类型与格式字符串匹配。XLOG_* 宏会让编译器按 printf
+//   规则检查格式串和参数类型 (-Wformat, 包含在 -Wall 中)。
+// - 运行时等级不满足时, XLOG_* 宏的参数不会被求值。
+// - 异步模式下日志最多延迟约 1ms 写出; 队列满时调用线程会等待, 不会丢日志。
+//   程序退出时 (Logger 析构) 会写完队列中剩余的日志。
+// - 延迟格式化模式要求格式串是字符串字面量 (静态存储), 参数只支持整数、浮点、
+//   C 字符串和指针。不同线程的日志之间不保证按时间排序。编码后达到线程缓冲区一半
+//   (128KB) 的单条日志会被丢弃, 后台线程随后输出一条 Error 日志汇报丢弃的条数。
+// - 限流宏的计数器是调用点内的静态变量: 模板函数的每个实例、内联函数的每个调用点各有一份。
+//   被丢弃的日志不求值参数。被丢弃的条数在该调用点下一次输出前汇报; 一直没有输出时,
+//   后台线程约每 10 秒汇报一次 (同步模式下由该调用点之后的丢弃触发), Logger 析构时汇报剩余的。
+// - 线程缓冲模式下同一线程的日志保持顺序, 不同线程之间以缓冲区为单位交错。
 //==============================================================================
 
 #pragma once
@@ -45,16 +90,46 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <ctime>
-#include <iomanip>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <ratio>
 #include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util/timestamp.h"
+
+#ifndef XLOG_MIN_LEVEL
+#ifdef NDEBUG
+#define XLOG_MIN_LEVEL 1
+#else
+#define XLOG_MIN_LEVEL 0
+#endif
+#endif
+
 namespace xlog {
 
 enum class LogLevel {
@@ -64,29 +139,722 @@ enum class LogLevel {
     OFF
 };
 
+namespace detail {
+
+// 只用于编译期检查: 编译器按 printf 规则核对格式串和参数类型, 从不被调用
+inline void CheckFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void CheckFormat(const char*, ...) {}
+
+// 有界无锁 MPSC 队列 (Vyukov 的有界队列, 只保留单消费者的部分)。
+// 每个槽位带一个序号: 序号 == 写位置 表示空闲, == 写位置 + 1 表示已写好可读。
+template<typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) : mask_(RoundUp(capacity) - 1), cells_(mask_ + 1) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // 生产者: 认领一个槽位并用 fill(T&) 原地填写。队列满时返回 false。
+    template<typename Fill>
+    bool TryPush(Fill&& fill) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(cell.value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 消费者: 队首元素, 尚未写好时返回 nullptr。
+    T* Front() {
+        Cell& cell = cells_[head_ & mask_];
+        return cell.seq.load(std::memory_order_acquire) == head_ + 1 ? &cell.value : nullptr;
+    }
+
+    void Pop() {
+        cells_[head_ & mask_].seq.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+    }
+
+    // 已认领的写位置总数, 用于 Flush 判断是否写完
+    size_t Pushed() const { return tail_.load(std::memory_order_acquire); }
+
+private:
+    static size_t RoundUp(size_t n) {
+        size_t p = 2;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    size_t mask_;
+    std::vector<Cell> cells_;
+    alignas(64) std::atomic<size_t> tail_{0};  // 生产者共享
+    alignas(64) size_t head_ = 0;              // 仅消费者访问
+};
+
+// 单生产者单消费者的字节环形缓冲区, 每个线程一个, 用于延迟格式化模式。
+// 记录按 8 字节对齐且不跨越缓冲区末尾; 放不下时用填充记录补齐末尾后回到开头。
+class ByteRing {
+public:
+    explicit ByteRing(size_t capacity) : buf_(capacity), mask_(capacity - 1) {}
+
+    // 生产者: 取得 size 字节的连续空间 (size 已按 8 对齐), 空间不足时返回 nullptr
+    uint8_t* Reserve(size_t size, size_t padHeader) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t offset = tail & mask_;
+        size_t pad = offset + size > buf_.size() ? buf_.size() - offset : 0;
+        if (buf_.size() - (tail - head) < pad + size) {
+            return nullptr;
+        }
+        if (pad > 0) {
+            // 填充记录: 只写 4 字节长度, 由调用方约定的标记区分
+            uint32_t marked = static_cast<uint32_t>(pad) | static_cast<uint32_t>(padHeader);
+            memcpy(&buf_[offset], &marked, sizeof(marked));
+            tail_.store(tail + pad, std::memory_order_release);
+            offset = 0;
+        }
+        return &buf_[offset];
+    }
+
+    void Commit(size_t size) {
+        tail_.store(tail_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+
+    // 消费者
+    size_t Tail() const { return tail_.load(std::memory_order_acquire); }
+    size_t Head() const { return head_.load(std::memory_order_acquire); }
+    const uint8_t* At(size_t pos) const { return &buf_[pos & mask_]; }
+    void Release(size_t head) { head_.store(head, std::memory_order_release); }
+
+    // 所属线程退出后置位, 消费者读完后将其移除
+    void SetOrphaned() { orphaned_.store(true, std::memory_order_release); }
+    bool Orphaned() const { return orphaned_.load(std::memory_order_acquire); }
+
+private:
+    std::vector<uint8_t> buf_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<size_t> head_{0};
+    std::atomic<bool> orphaned_{false};
+};
+
+// 延迟格式化记录的参数编码: 1 字节类型 + 8 字节值; 字符串为 1 字节类型 + 4 字节长度 + 内容
+enum ArgTag : uint8_t { kArgInt, kArgUint, kArgDouble, kArgString, kArgPointer };
+
+constexpr uint32_t kMaxDeferredString = 4096;  // 超长字符串参数被截断
+
+template<typename T>
+struct ArgCodec {
+    using D = typename std::decay<T>::type;
+    static constexpr bool kString = std::is_same<D, const char*>::value || std::is_same<D, char*>::value;
+    static_assert(kString || std::is_arithmetic<D>::value || std::is_enum<D>::value ||
+                      std::is_pointer<D>::value || std::is_same<D, std::nullptr_t>::value,
+                  "xlog deferred mode: unsupported argument type");
+
+    static size_t Size(const T& v) {
+        if constexpr (kString) {
+            const char* str = v;  // 字符数组退化为指针
+            return 1 + 4 + (str ? strnlen(str, kMaxDeferredString) : 6);
+        } else {
+            return 1 + 8;
+        }
+    }
+
+    static uint8_t* Encode(uint8_t* p, const T& v) {
+        if constexpr (kString) {
+            const char* str = v;
+            str = str ? str : "(null)";
+            uint32_t len = static_cast<uint32_t>(strnlen(str, kMaxDeferredString));
+            *p++ = kArgString;
+            memcpy(p, &len, 4);
+            memcpy(p + 4, str, len);
+            return p + 4 + len;
+        } else {
+            uint64_t bits;
+            if constexpr (std::is_floating_point<D>::value) {
+                *p = kArgDouble;
+                double d = static_cast<double>(v);
+                memcpy(&bits, &d, 8);
+            } else if constexpr (std::is_pointer<D>::value || std::is_same<D, std::nullptr_t>::value) {
+                *p = kArgPointer;
+                bits = reinterpret_cast<uintptr_t>(static_cast<const void*>(v));
+            } else if constexpr (std::is_enum<D>::value) {
+                *p = kArgInt;
+                bits = static_cast<uint64_t>(static_cast<int64_t>(v));
+            } else if constexpr (std::is_signed<D>::value) {
+                *p = kArgInt;
+                bits = static_cast<uint64_t>(static_cast<int64_t>(v));
+            } else {
+                *p = kArgUint;
+                bits = static_cast<uint64_t>(v);
+            }
+            memcpy(p + 1, &bits, 8);
+            return p + 1 + 8;
+        }
+    }
+};
+
+// 按格式串解码参数并追加到 out。逐个转换说明调用 snprintf, 长度修饰符按 printf 规则截断,
+// 因此结果与直接 printf 一致。参数缺失或类型不符时输出 "<?>"。
+inline void FormatDeferred(std::string& out, const char* format, const uint8_t* args,
+                           const uint8_t* end) {
+    struct Arg {
+        uint8_t tag = 0xFF;
+        uint64_t bits = 0;
+        std::string str;
+    };
+    auto next = [&](Arg& a) {
+        if (args >= end) {
+            a.tag = 0xFF;
+            return;
+        }
+        a.tag = *args++;
+        if (a.tag == kArgString) {
+            uint32_t len;
+            memcpy(&len, args, 4);
+            a.str.assign(reinterpret_cast<const char*>(args + 4), len);
+            args += 4 + len;
+        } else {
+            memcpy(&a.bits, args, 8);
+            args += 8;
+        }
+    };
+    auto append = [&out](const std::string& spec, auto value) {
+        char small[128];
+        int n = snprintf(small, sizeof(small), spec.c_str(), value);
+        if (n < 0) {
+            return;
+        }
+        if (static_cast<size_t>(n) < sizeof(small)) {
+            out.append(small, n);
+        } else {
+            size_t at = out.size();
+            out.resize(at + n + 1);
+            snprintf(&out[at], n + 1, spec.c_str(), value);
+            out.resize(at + n);
+        }
+    };
+
+    Arg arg;
+    const char* p = format;
+    while (*p) {
+        if (*p != '%') {
+            const char* q = strchr(p, '%');
+            size_t n = q ? static_cast<size_t>(q - p) : strlen(p);
+            out.append(p, n);
+            p += n;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion
+        std::string spec = "%";
+        const char* q = p + 1;
+        while (*q && strchr("-+ #0'", *q)) spec += *q++;
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*q != '.') break;
+                spec += *q++;
+            }
+            if (*q == '*') {
+                next(arg);
+                spec += std::to_string(arg.tag == kArgInt || arg.tag == kArgUint ? static_cast<int>(arg.bits) : 0);
+                ++q;
+            }
+            while (*q >= '0' && *q <= '9') spec += *q++;
+        }
+        std::string length;
+        while (*q && strchr("hlLqjzt", *q)) length += *q++;
+        char conv = *q;
+        p = *q ? q + 1 : q;
+        if (conv == 'n') {
+            next(arg);
+            continue;
+        }
+        next(arg);
+        bool integer = arg.tag == kArgInt || arg.tag == kArgUint;
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (!integer) break;
+                spec += "ll";
+                spec += conv;
+                if (length == "hh") append(spec, static_cast<long long>(static_cast<signed char>(arg.bits)));
+                else if (length == "h") append(spec, static_cast<long long>(static_cast<short>(arg.bits)));
+                else if (length.empty()) append(spec, static_cast<long long>(static_cast<int>(arg.bits)));
+                else if (length == "l") append(spec, static_cast<long long>(static_cast<long>(arg.bits)));
+                else append(spec, static_cast<long long>(arg.bits));
+                continue;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (!integer) break;
+                spec += "ll";
+                spec += conv;
+                if (length == "hh") append(spec, static_cast<unsigned long long>(static_cast<unsigned char>(arg.bits)));
+                else if (length == "h") append(spec, static_cast<unsigned long long>(static_cast<unsigned short>(arg.bits)));
+                else if (length.empty()) append(spec, static_cast<unsigned long long>(static_cast<unsigned>(arg.bits)));
+                else if (length == "l") append(spec, static_cast<unsigned long long>(static_cast<unsigned long>(arg.bits)));
+                else append(spec, static_cast<unsigned long long>(arg.bits));
+                continue;
+            case 'c':
+                if (!integer) break;
+                append(spec + 'c', static_cast<int>(arg.bits));
+                continue;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+                if (arg.tag != kArgDouble) break;
+                double d;
+                memcpy(&d, &arg.bits, 8);
+                append(spec + conv, d);
+                continue;
+            }
+            case 's':
+                if (arg.tag != kArgString) break;
+                append(spec + 's', arg.str.c_str());
+                continue;
+            case 'p':
+                if (arg.tag != kArgPointer) break;
+                append(spec + 'p', reinterpret_cast<void*>(static_cast<uintptr_t>(arg.bits)));
+                continue;
+            default:
+                break;
+        }
+        out += "<?>";
+    }
+}
+
+// 滚动日志文件: base.0.log, base.1.log, ...
+// 当前段文件用 fallocate 预分配 maxBytes 并整个 mmap, 写入就是 memcpy。写满或超过 maxAge
+// 时切到下一段; 下一段由后台线程提前建好, 旧段也由后台线程 munmap、截断到实际长度并关闭,
+// 超过 maxFiles 的最旧文件被删除 (包括之前的进程留下的)。Write 不是线程安全的, 由调用方串行化。
+class RollingFile {
+public:
+    RollingFile(const std::string& base, size_t maxBytes, std::chrono::seconds maxAge, int maxFiles)
+        : base_(base),
+          maxBytes_(std::max<size_t>(maxBytes, 4096)),
+          maxAge_(maxAge.count() > 0 ? maxAge.count() : 0),
+          maxFiles_(std::max(maxFiles, 1)) {
+        RecoverExisting();
+        active_ = Open(nextIndex_);
+        nextIndex_ = active_.index + 1;
+        active_.opened = time(nullptr);
+        worker_ = std::thread([this] { Loop(); });
+    }
+
+    ~RollingFile() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        worker_.join();
+        Close(active_);
+        if (next_.fd >= 0) {
+            uint64_t unused = next_.index;
+            Close(next_);
+            unlink(PathOf(unused).c_str());
+        }
+        for (Segment& s : retired_) {
+            Close(s);
+        }
+    }
+
+    RollingFile(const RollingFile&) = delete;
+    RollingFile& operator=(const RollingFile&) = delete;
+
+    bool ok() const { return active_.map != nullptr; }
+
+    void Write(const iovec* iov, int count) {
+        for (int i = 0; i < count; ++i) {
+            const char* data = static_cast<const char*>(iov[i].iov_base);
+            size_t len = iov[i].iov_len;
+            while (len > 0) {
+                if (!active_.map || active_.used == active_.capacity || Expired()) {
+                    Rotate();
+                    if (!active_.map) {
+                        return;  // 无法创建新段, 丢弃
+                    }
+                }
+                size_t n = std::min(len, active_.capacity - active_.used);
+                memcpy(active_.map + active_.used, data, n);
+                active_.used += n;
+                data += n;
+                len -= n;
+            }
+        }
+    }
+
+private:
+    struct Segment {
+        int fd = -1;
+        char* map = nullptr;
+        size_t capacity = 0;
+        size_t used = 0;
+        time_t opened = 0;  // 成为当前段的时间; 预建的下一段等待期间不计入
+        uint64_t index = 0;
+    };
+
+    std::string PathOf(uint64_t index) const { return base_ + "." + std::to_string(index) + ".log"; }
+
+    // 整理之前的进程留下的 base.N.log。进程崩溃时来不及截断的段尾部是预分配的 0 字节,
+    // 截掉; 截完为空的 (比如预建后没用上的下一段) 删除。新段从最大的 N 加一开始, 不覆盖旧文件;
+    // firstIndex_ 从剩下的最小的 N 开始, 旧文件同样计入 maxFiles_。
+    void RecoverExisting() {
+        size_t slash = base_.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : base_.substr(0, slash + 1);
+        std::string prefix = (slash == std::string::npos ? base_ : base_.substr(slash + 1)) + ".";
+        std::vector<uint64_t> found;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* e = readdir(d)) {
+                const char* name = e->d_name;
+                if (strncmp(name, prefix.c_str(), prefix.size()) != 0) {
+                    continue;
+                }
+                char* end;
+                unsigned long long index = strtoull(name + prefix.size(), &end, 10);
+                if (end != name + prefix.size() && strcmp(end, ".log") == 0) {
+                    found.push_back(index);
+                }
+            }
+            closedir(d);
+        }
+        uint64_t first = UINT64_MAX;
+        nextIndex_ = 0;
+        for (uint64_t index : found) {
+            nextIndex_ = std::max(nextIndex_, index + 1);
+            if (TrimZeroTail(PathOf(index))) {
+                first = std::min(first, index);
+            }
+        }
+        firstIndex_ = first == UINT64_MAX ? nextIndex_ : first;
+    }
+
+    // 截掉文件尾部的 0 字节 (日志是文本, 不含 0 字节)。截完为空时删除文件并返回 false
+    static bool TrimZeroTail(const std::string& path) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            return true;  // 打不开就原样保留
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            return true;  // 另一个 RollingFile 正在写
+        }
+        off_t size = lseek(fd, 0, SEEK_END);
+        off_t end = std::max<off_t>(size, 0);
+        std::vector<char> buf(64 * 1024);
+        // 从后往前按块读; 正常关闭的文件最后一个字节就不是 0, 只读一块
+        while (end > 0) {
+            size_t n = static_cast<size_t>(std::min<off_t>(end, static_cast<off_t>(buf.size())));
+            if (pread(fd, buf.data(), n, end - static_cast<off_t>(n)) != static_cast<ssize_t>(n)) {
+                break;  // 读失败时保留剩下的部分
+            }
+            size_t i = n;
+            while (i > 0 && buf[i - 1] == 0) {
+                --i;
+            }
+            end -= static_cast<off_t>(n - i);
+            if (i > 0) {
+                break;
+            }
+        }
+        if (end < size && ftruncate(fd, end) != 0) {
+            end = size;  // 截断失败时按原样保留
+        }
+        close(fd);
+        if (end == 0) {
+            unlink(path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // 新建 index 或之后第一个不存在的段。已存在的文件可能正被另一个 RollingFile 写入
+    // (比如以同一 base 再次调用 SetRollingFile), 不能截断。s.index 是实际使用的 index
+    Segment Open(uint64_t index) {
+        Segment s;
+        for (;; ++index) {
+            s.index = index;
+            s.fd = open(PathOf(index).c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (s.fd >= 0 || errno != EEXIST) {
+                break;
+            }
+        }
+        if (s.fd < 0) {
+            return s;
+        }
+        // 标记正在使用, 之后以同一 base 启动的 RollingFile 不会去截断它
+        flock(s.fd, LOCK_EX | LOCK_NB);
+        // 预分配磁盘空间, 写满前不会因为空间不足而在 mmap 写入时收到 SIGBUS
+        void* p = MAP_FAILED;
+        if (posix_fallocate(s.fd, 0, static_cast<off_t>(maxBytes_)) == 0) {
+            p = mmap(nullptr, maxBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, s.fd, 0);
+        }
+        if (p == MAP_FAILED) {
+            unlink(PathOf(s.index).c_str());  // 下次重试同一个 index
+            close(s.fd);
+            s.fd = -1;
+            return s;
+        }
+        s.map = static_cast<char*>(p);
+        s.capacity = maxBytes_;
+        return s;
+    }
+
+    // 解除映射并截掉预分配的空白尾部
+    static void Close(Segment& s) {
+        if (s.map) {
+            munmap(s.map, s.capacity);
+        }
+        if (s.fd >= 0) {
+            if (ftruncate(s.fd, static_cast<off_t>(s.used)) != 0) {
+                // 截断失败时文件尾部保留为 0 字节
+            }
+            close(s.fd);
+        }
+        s = Segment();
+    }
+
+    bool Expired() const { return maxAge_ > 0 && time(nullptr) - active_.opened >= maxAge_; }
+
+    // 换上后台线程准备好的下一段 (通常无需等待), 旧段交给后台线程收尾
+    void Rotate() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return next_.map != nullptr || nextFailed_; });
+        if (active_.map) {
+            retired_.push_back(active_);
+        }
+        active_ = next_;
+        active_.opened = time(nullptr);
+        next_ = Segment();
+        nextFailed_ = false;
+        lock.unlock();
+        cv_.notify_one();
+    }
+
+    void Loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            if (!next_.map && !nextFailed_) {
+                uint64_t index = nextIndex_++;
+                lock.unlock();
+                Segment s = Open(index);
+                lock.lock();
+                nextIndex_ = s.map ? std::max(nextIndex_, s.index + 1) : index;
+                next_ = s;
+                nextFailed_ = !s.map;
+                cv_.notify_all();
+            }
+            while (!retired_.empty()) {
+                Segment s = retired_.front();
+                retired_.pop_front();
+                lock.unlock();
+                msync(s.map, s.used, MS_ASYNC);
+                Close(s);
+                lock.lock();
+            }
+            // 只保留最新的 maxFiles_ 个写过日志的文件 (已退役的段加上当前段);
+            // 预建的下一段还是空文件, 不计入, 所以磁盘上最多有 maxFiles_ + 1 个文件
+            while (nextIndex_ - firstIndex_ > static_cast<uint64_t>(maxFiles_) + 1) {
+                unlink(PathOf(firstIndex_++).c_str());
+            }
+            if (stop_) {
+                return;
+            }
+            bool woken = cv_.wait_for(lock, std::chrono::seconds(1), [this] {
+                return stop_ || (!next_.map && !nextFailed_) || !retired_.empty();
+            });
+            if (!woken) {
+                nextFailed_ = false;  // 建段失败时每秒重试一次
+            }
+        }
+    }
+
+    std::string base_;
+    size_t maxBytes_;
+    time_t maxAge_;
+    int maxFiles_;
+    Segment active_;  // 只被 Write 访问
+
+    std::mutex mutex_;  // 保护以下成员
+    std::condition_variable cv_;
+    Segment next_;
+    bool nextFailed_ = false;
+    std::deque<Segment> retired_;
+    uint64_t firstIndex_ = 0;  // 仍保留的最旧文件
+    uint64_t nextIndex_ = 0;
+    bool stop_ = false;
+    std::thread worker_;
+};
+
+// 单调时钟纳秒数, 用于限流。COARSE 只读 vDSO 里的变量, 精度为一个内核 tick
+inline int64_t MonotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+constexpr int64_t kSuppressReportNs = 10LL * 1000000000;  // 被抑制条数的汇报间隔
+
+// 限流宏的调用点状态, 每个调用点一个静态实例 (常量初始化, 没有构造开销)。
+// 判断是否输出只用原子操作, 被丢弃的日志不加锁、不格式化、不求值参数以外的任何东西。
+// 第一次丢弃时调用点挂到全局链表上, 后台线程和 Logger 析构时据此汇报没人认领的丢弃条数。
+struct LogSite {
+    std::atomic<uint64_t> count{0};       // 调用次数
+    std::atomic<int64_t> tat{0};          // 令牌桶: 下一个令牌的理论到达时间 (ns)
+    std::atomic<uint64_t> suppressed{0};  // 上次汇报以来被丢弃的条数
+    std::atomic<int64_t> lastReport{0};   // 上次汇报的时间 (ns)
+    std::atomic<bool> listed{false};      // 是否已挂到 Sites() 链表上
+    const char* file = nullptr;           // 以下三项在挂上链表前写入, 之后只读
+    int line = 0;
+    LogLevel level = LogLevel::Error;
+    LogSite* next = nullptr;
+
+    // 有过丢弃的调用点, 只增不减 (调用点都是静态变量)
+    static std::atomic<LogSite*>& Sites() {
+        static std::atomic<LogSite*> head{nullptr};
+        return head;
+    }
+
+    // 第 1, n+1, 2n+1, ... 次调用输出
+    bool EveryN(uint64_t n) {
+        return count.fetch_add(1, std::memory_order_relaxed) % (n ? n : 1) == 0;
+    }
+
+    // 前 n 次调用输出, 之后只读不写
+    bool FirstN(uint64_t n) {
+        return count.load(std::memory_order_relaxed) < n &&
+               count.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+
+    // 令牌桶 (GCRA 形式): 每秒 perSecond 个令牌, 桶容量为 1 秒的量 (至少一个令牌)。
+    // 只用一个原子变量记录理论到达时间, 多线程下用 CAS 更新。
+    bool Rate(double perSecond) {
+        if (perSecond <= 0) {
+            return false;
+        }
+        int64_t interval = static_cast<int64_t>(1e9 / perSecond);
+        int64_t capacity = std::max<int64_t>(interval, 1000000000);
+        int64_t now = MonotonicNs();
+        int64_t old = tat.load(std::memory_order_relaxed);
+        for (;;) {
+            int64_t next = std::max(old, now) + interval;
+            if (next - now > capacity) {
+                return false;
+            }
+            if (tat.compare_exchange_weak(old, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // 记录一次丢弃。距上次汇报超过 kSuppressReportNs 时返回需要汇报的条数, 否则返回 0
+    uint64_t Suppress(const char* siteFile, int siteLine, LogLevel siteLevel) {
+        if (suppressed.fetch_add(1, std::memory_order_relaxed) == 0 &&
+            !listed.load(std::memory_order_relaxed) && !listed.exchange(true, std::memory_order_relaxed)) {
+            file = siteFile;
+            line = siteLine;
+            level = siteLevel;
+            next = Sites().load(std::memory_order_relaxed);
+            while (!Sites().compare_exchange_weak(next, this, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+            }
+        }
+        int64_t now = MonotonicNs();
+        int64_t last = lastReport.load(std::memory_order_relaxed);
+        if (last == 0) {
+            lastReport.compare_exchange_strong(last, now, std::memory_order_relaxed);
+            return 0;
+        }
+        if (now - last < kSuppressReportNs ||
+            !lastReport.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            return 0;
+        }
+        return suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    // 取走尚未汇报的丢弃条数。没有丢弃时只有一次读
+    uint64_t TakeSuppressed() {
+        if (suppressed.load(std::memory_order_relaxed) == 0) {
+            return 0;
+        }
+        lastReport.store(MonotonicNs(), std::memory_order_relaxed);
+        return suppressed.exchange(0, std::memory_order_relaxed);
+    }
+};
+
+} // namespace detail
+
 class Logger {
 public:
+    // 限流宏汇报被丢弃条数的格式串: 文件、行号、条数
+    static constexpr char kSuppressedFormat[] = "%s:%d: suppressed %llu messages";
+
     static void SetLogLevel(LogLevel level) {
-        GetInstance().currentLogLevel_ = level;
+        GetInstance().currentLogLevel_.store(level, std::memory_order_relaxed);
+    }
+
+    // 该等级的日志是否会输出 (编译期等级和运行时等级都满足)
+    static bool IsEnabled(LogLevel level) {
+        if (static_cast<int>(level) < XLOG_MIN_LEVEL) {
+            return false;
+        }
+        LogLevel current = GetInstance().currentLogLevel_.load(std::memory_order_relaxed);
+        return current != LogLevel::OFF && level >= current;
+    }
+
+    // 输出到滚动日志文件 base.N.log: 单个文件最大 maxBytes, 最长 maxAge (0 不限), 最多保留
+    // maxFiles 个。之后的日志都写入滚动文件, 优先于 SetOutputToFile。
+    static bool SetRollingFile(const std::string& base, size_t maxBytes,
+                               std::chrono::seconds maxAge = std::chrono::seconds(0), int maxFiles = 8) {
+        auto file = std::make_unique<detail::RollingFile>(base, maxBytes, maxAge, maxFiles);
+        if (!file->ok()) {
+            return false;
+        }
+        std::unique_ptr<detail::RollingFile> old;
+        std::lock_guard<std::mutex> lock(GetInstance().mutex_);
+        old.swap(GetInstance().rolling_);
+        GetInstance().rolling_ = std::move(file);
+        return true;
     }
 
     // 设置日志输出到文件。如果当前正在输出到屏幕，则只在第一次调用时有效。
     static bool SetOutputToFile(const std::string& filename) {
         std::lock_guard<std::mutex> lock(GetInstance().mutex_);
         // 只有当当前是输出到屏幕时，才尝试设置文件输出
-        if (GetInstance().outputStream_ == &std::cout) {
-            GetInstance().outputFile_.open(filename, std::ios::app); // 追加模式
-            if (GetInstance().outputFile_.is_open()) {
-                GetInstance().outputStream_ = &GetInstance().outputFile_;
+        if (GetInstance().outputFd_ == STDOUT_FILENO) {
+            int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644); // 追加模式
+            if (fd >= 0) {
+                GetInstance().outputFd_ = fd;
                 return true;
-            } else {
-                // 如果文件打开失败，回退到屏幕输出
-                GetInstance().outputStream_ = &std::cout;
-                return false;
             }
+            // 如果文件打开失败，保持屏幕输出
+            return false;
         }
-        // 如果输出已经设置为文件，则不做任何事，并报告文件是否已打开
-        return GetInstance().outputFile_.is_open();
+        // 如果输出已经设置为文件，则不做任何事
+        return true;
     }
 
     // 启用/禁用时间戳
@@ -94,44 +862,251 @@ public:
         GetInstance().timestampEnabled_ = enable;
     }
 
+    // 启用/禁用异步模式。关闭时会先写完队列中的日志。应在程序启动时配置。
+    static void SetAsync(bool enable) {
+        Logger& self = GetInstance();
+        std::lock_guard<std::mutex> lock(self.configMutex_);
+        if (enable == self.asyncEnabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (enable && !self.queue_) {
+            self.queue_ = std::make_unique<detail::MpscQueue<AsyncRecord>>(kAsyncQueueSize);
+        }
+        self.asyncEnabled_.store(enable, std::memory_order_release);
+        self.UpdateWorker();
+    }
+
+    // 启用/禁用延迟格式化模式。关闭时会先写完已提交的日志。应在程序启动时配置。
+    static void SetDeferred(bool enable) {
+        Logger& self = GetInstance();
+        std::lock_guard<std::mutex> lock(self.configMutex_);
+        if (enable == self.deferredEnabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        self.deferredEnabled_.store(enable, std::memory_order_release);
+        self.UpdateWorker();
+    }
+
+    // 启用/禁用线程缓冲模式。maxLatency 是一行日志在线程缓冲区中停留的最长时间
+    // (精度约 1ms)。关闭时会先写完缓冲区中的日志。应在程序启动时配置。
+    static void SetBuffered(bool enable,
+                            std::chrono::milliseconds maxLatency = std::chrono::milliseconds(100)) {
+        Logger& self = GetInstance();
+        std::lock_guard<std::mutex> lock(self.configMutex_);
+        self.maxLatencyTicks_.store(std::max<int64_t>(1, maxLatency.count()), std::memory_order_relaxed);
+        if (enable == self.bufferedEnabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (!enable) {
+            self.bufferedEnabled_.store(false, std::memory_order_release);
+            FlushLineBuffers();
+        }
+        self.bufferedEnabled_.store(enable, std::memory_order_release);
+        self.UpdateWorker();
+    }
+
+    // 延迟格式化的日志改为写入二进制文件 (覆盖), 用 DecodeBinaryLog 解码
+    static bool SetBinaryOutput(const std::string& filename) {
+        Logger& self = GetInstance();
+        std::lock_guard<std::mutex> lock(self.mutex_);
+        self.binaryFile_.close();
+        self.binaryFile_.open(filename, std::ios::binary | std::ios::trunc);
+        self.knownFormats_.clear();
+        if (!self.binaryFile_.is_open()) {
+            return false;
+        }
+        self.binaryFile_.write(kBinaryMagic, sizeof(kBinaryMagic));
+        return true;
+    }
+
+    // 离线解码二进制日志, 以文本形式 (始终带时间戳) 输出到 os
+    static bool DecodeBinaryLog(const std::string& filename, std::ostream& os) {
+        std::ifstream in(filename, std::ios::binary);
+        char magic[sizeof(kBinaryMagic)];
+        if (!in.read(magic, sizeof(magic)) || memcmp(magic, kBinaryMagic, sizeof(magic)) != 0) {
+            return false;
+        }
+        std::unordered_map<uint64_t, std::string> formats;
+        std::vector<uint8_t> record;
+        std::string line;
+        char type;
+        while (in.get(type)) {
+            if (type == 'F') {
+                uint64_t id;
+                uint32_t len;
+                in.read(reinterpret_cast<char*>(&id), sizeof(id));
+                in.read(reinterpret_cast<char*>(&len), sizeof(len));
+                std::string fmt(len, '\0');
+                in.read(&fmt[0], len);
+                formats[id] = fmt;
+            } else if (type == 'M') {
+                DeferredHeader h;
+                if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || h.size < sizeof(h)) {
+                    return false;
+                }
+                record.resize(h.size - sizeof(h));
+                in.read(reinterpret_cast<char*>(record.data()), record.size());
+                auto it = formats.find(h.format);
+                line.clear();
+                FormatDeferredRecord(line, h, it == formats.end() ? "<unknown format>" : it->second.c_str(),
+                                     record.data(), true);
+                os << line;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 等待此前提交的异步/延迟格式化日志全部写出 (同步模式下无操作)
+    static void Flush() {
+        Logger& self = GetInstance();
+        if (self.asyncEnabled_.load(std::memory_order_acquire)) {
+            size_t target = self.queue_->Pushed();
+            while (self.consumed_.load(std::memory_order_acquire) < target) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        if (self.deferredEnabled_.load(std::memory_order_acquire)) {
+            std::vector<std::pair<std::shared_ptr<detail::ByteRing>, size_t>> targets;
+            {
+                std::lock_guard<std::mutex> lock(self.ringsMutex_);
+                for (auto& ring : self.rings_) {
+                    targets.emplace_back(ring, ring->Tail());
+                }
+            }
+            for (auto& t : targets) {
+                while (t.first->Head() < t.second) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+            std::lock_guard<std::mutex> lock(self.mutex_);
+            if (self.binaryFile_.is_open()) {
+                self.binaryFile_.flush();
+            }
+        }
+        if (self.bufferedEnabled_.load(std::memory_order_acquire)) {
+            FlushLineBuffers();
+        }
+    }
+
     // 日志 API (带换行)
     template<typename... Args>
-    static void Error(const char* format, Args... args) {
-        Log(LogLevel::Error, true, format, args...);
+    static void Error(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Error, true, format, std::forward<Args>(args)...);
     }
 
     template<typename... Args>
-    static void Info(const char* format, Args... args) {
-        Log(LogLevel::Info, true, format, args...);
+    static void Info(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Info, true, format, std::forward<Args>(args)...);
     }
 
     template<typename... Args>
-    static void Debug(const char* format, Args... args) {
-        Log(LogLevel::Debug, true, format, args...);
+    static void Debug(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Debug, true, format, std::forward<Args>(args)...);
     }
 
     // 日志 API (不带换行)
     template<typename... Args>
-    static void ErrorRaw(const char* format, Args... args) {
-        Log(LogLevel::Error, false, format, args...);
+    static void ErrorRaw(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Error, false, format, std::forward<Args>(args)...);
     }
 
     template<typename... Args>
-    static void InfoRaw(const char* format, Args... args) {
-        Log(LogLevel::Info, false, format, args...);
+    static void InfoRaw(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Info, false, format, std::forward<Args>(args)...);
     }
 
     template<typename... Args>
-    static void DebugRaw(const char* format, Args... args) {
-        Log(LogLevel::Debug, false, format, args...);
+    static void DebugRaw(const char* format, Args&&... args) {
+        Dispatch(LogLevel::Debug, false, format, std::forward<Args>(args)...);
     }
 
 private:
+    static constexpr size_t kAsyncQueueSize = 8192;  // 队列槽位数
+    static constexpr size_t kAsyncInlineText = 256;  // 槽位内联的消息长度, 更长的消息另行分配
+    static constexpr size_t kAsyncBatch = 256;       // 后台线程每批最多写出的条数
+
+    static constexpr size_t kDeferredRingSize = 256 * 1024;  // 每个线程的延迟格式化缓冲区
+    static constexpr uint32_t kPaddingFlag = 0x80000000u;    // 填充记录的长度标记
+    static constexpr char kBinaryMagic[8] = {'X', 'L', 'O', 'G', 'B', 'I', 'N', '1'};
+    static constexpr char kOversizedFormat[] = "xlog: dropped %llu deferred records of %llu bytes or more";
+
+    // 延迟格式化记录头, 后接编码后的参数; size 含记录头, 按 8 字节对齐
+    struct DeferredHeader {
+        uint32_t size;
+        uint8_t level;
+        uint8_t addNewline;
+        uint16_t argCount;
+        int64_t timeNs;   // system_clock 纪元以来的纳秒
+        uint64_t format;  // 格式串地址, 即格式串 id
+    };
+
+    // 线程退出时标记其缓冲区, 由后台线程读完后回收
+    struct ThreadRing {
+        std::shared_ptr<detail::ByteRing> ring;
+        ~ThreadRing() {
+            if (ring) {
+                ring->SetOrphaned();
+            }
+        }
+    };
+
+    static constexpr size_t kLineChunkSize = 64 * 1024;  // 线程缓冲模式下每个缓冲区的大小
+
+    // 线程缓冲模式下一个线程的缓冲区。lock 只在本线程写入和后台线程取走时竞争。
+    struct LineChunk {
+        std::unique_ptr<char[]> data;
+        size_t capacity = 0;
+        size_t size = 0;
+    };
+
+    struct ThreadLines {
+        std::mutex lock;
+        LineChunk chunk;
+        int64_t sinceTick = 0;  // chunk 中第一行写入时的后台线程 tick
+        bool orphaned = false;  // 所属线程已退出
+    };
+
+    struct ThreadLinesHolder {
+        std::shared_ptr<ThreadLines> lines;
+        ~ThreadLinesHolder() {
+            if (lines) {
+                std::lock_guard<std::mutex> lock(lines->lock);
+                GetInstance().HandOff(lines->chunk);
+                lines->orphaned = true;
+            }
+        }
+    };
+
+    // 异步模式下的一条日志: 消息已格式化, 前缀 (时间戳、等级) 由后台线程生成
+    struct AsyncRecord {
+        LogLevel level;
+        bool addNewline;
+        std::chrono::system_clock::time_point time;
+        size_t length;
+        char text[kAsyncInlineText];
+        std::string longText;  // length >= kAsyncInlineText 时使用
+    };
+
     // 单例的私有构造函数和析构函数
-    Logger() : currentLogLevel_(LogLevel::Error), outputStream_(&std::cout), timestampEnabled_(false) {}
+    Logger() : currentLogLevel_(LogLevel::Error), outputFd_(STDOUT_FILENO), timestampEnabled_(false) {}
     ~Logger() {
-        if (outputFile_.is_open()) {
-            outputFile_.close();
+        asyncEnabled_.store(false, std::memory_order_release);
+        deferredEnabled_.store(false, std::memory_order_release);
+        if (bufferedEnabled_.exchange(false, std::memory_order_acq_rel)) {
+            FlushLineBuffers();
+        }
+        StopWorker();
+        {
+            std::string batch;
+            std::lock_guard<std::mutex> lock(mutex_);
+            ReportSuppressed(batch);
+            WriteOut(batch.data(), batch.size());
+        }
+        rolling_.reset();
+        if (outputFd_ != STDOUT_FILENO) {
+            close(outputFd_);
         }
     }
 
@@ -140,45 +1115,539 @@ private:
         return instance;
     }
 
+    template<typename... Args>
+    static void Dispatch(LogLevel level, bool addNewline, const char* format, Args&&... args) {
+        if (!IsEnabled(level)) {
+            return;
+        }
+        if (GetInstance().deferredEnabled_.load(std::memory_order_acquire)) {
+            PushDeferred(level, addNewline, format, args...);
+            return;
+        }
+        Log(level, addNewline, format, std::forward<Args>(args)...);
+    }
+
+    // 延迟格式化: 只拷贝格式串指针、时间和原始参数到本线程缓冲区
+    template<typename... Args>
+    static void PushDeferred(LogLevel level, bool addNewline, const char* format, const Args&... args) {
+        size_t size = sizeof(DeferredHeader);
+        ((size += detail::ArgCodec<Args>::Size(args)), ...);
+        size = (size + 7) & ~size_t{7};
+        if (size >= kDeferredRingSize / 2) {
+            // 单条日志过大: 只计数, 由后台线程汇报
+            GetInstance().deferredOversized_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        detail::ByteRing& ring = LocalRing();
+        uint8_t* p;
+        while (!(p = ring.Reserve(size, kPaddingFlag))) {
+            std::this_thread::yield();
+        }
+        DeferredHeader h;
+        h.size = static_cast<uint32_t>(size);
+        h.level = static_cast<uint8_t>(level);
+        h.addNewline = addNewline;
+        h.argCount = sizeof...(Args);
+        h.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       Now().time_since_epoch()).count();
+        h.format = reinterpret_cast<uintptr_t>(format);
+        memcpy(p, &h, sizeof(h));
+        [[maybe_unused]] uint8_t* q = p + sizeof(h);
+        ((q = detail::ArgCodec<Args>::Encode(q, args)), ...);
+        ring.Commit(size);
+    }
+
+    static detail::ByteRing& LocalRing() {
+        thread_local ThreadRing local;
+        if (!local.ring) {
+            local.ring = std::make_shared<detail::ByteRing>(kDeferredRingSize);
+            Logger& self = GetInstance();
+            std::lock_guard<std::mutex> lock(self.ringsMutex_);
+            self.rings_.push_back(local.ring);
+        }
+        return *local.ring;
+    }
+
+    static void FormatDeferredRecord(std::string& out, const DeferredHeader& h, const char* format,
+                                     const uint8_t* args, bool timestamp) {
+        char prefix[64];
+        std::chrono::system_clock::time_point time{
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(h.timeNs))};
+        out += FormatPrefix(prefix, static_cast<LogLevel>(h.level), time, timestamp);
+        detail::FormatDeferred(out, format, args, args + (h.size - sizeof(h)));
+        if (h.addNewline) {
+            out += '\n';
+        }
+    }
+
+    // 调用方 (Dispatch) 已检查等级
     static void Log(LogLevel level, bool addNewline, const char* format, ...) {
-        if (GetInstance().currentLogLevel_ == LogLevel::OFF || level < GetInstance().currentLogLevel_) {
+        if (GetInstance().asyncEnabled_.load(std::memory_order_acquire)) {
+            va_list args;
+            va_start(args, format);
+            GetInstance().PushAsync(level, addNewline, format, args);
+            va_end(args);
             return;
         }
 
+        va_list args;
+        va_start(args, format);
+        if (GetInstance().bufferedEnabled_.load(std::memory_order_acquire)) {
+            GetInstance().AppendBuffered(level, addNewline, format, args);
+            va_end(args);
+            return;
+        }
+
+        // 同步模式: 整行格式化到线程局部的缓冲区, 一次 write 写出
+        thread_local std::string line;
+        line.clear();
+        AppendLine(line, level, addNewline, Now(), format, args);
+        va_end(args);
         std::lock_guard<std::mutex> lock(GetInstance().mutex_);
+        GetInstance().WriteOut(line.data(), line.size());
+    }
 
-        if (GetInstance().outputStream_) {
-            if (GetInstance().timestampEnabled_) {
-                auto now = std::chrono::system_clock::now();
-                auto time_t_now = std::chrono::system_clock::to_time_t(now);
-                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-                std::tm tm_now;
-                localtime_r(&time_t_now, &tm_now);
-                *GetInstance().outputStream_ << std::put_time(&tm_now, "%H:%M:%S") << '.' << std::setw(3)
-                                             << std::setfill('0') << ms.count() << " ";
+    // 格式化一整行 (前缀 + 消息 [+ 换行]) 到 dst, 返回所需长度; 长度 >= cap 时内容被截断
+    static size_t FormatLineTo(char* dst, size_t cap, LogLevel level, bool addNewline,
+                               std::chrono::system_clock::time_point now, const char* format,
+                               va_list args) {
+        char prefix[64];
+        size_t n = strlen(FormatPrefix(prefix, level, now));
+        memcpy(dst, prefix, std::min(n, cap));
+        va_list args_copy;
+        va_copy(args_copy, args);
+        int size = vsnprintf(dst + std::min(n, cap), cap - std::min(n, cap), format, args_copy);
+        va_end(args_copy);
+        if (size < 0) {
+            static const char kError[] = "Error formatting log message";  // 格式化错误消息
+            size = sizeof(kError) - 1;
+            if (n + size <= cap) {
+                memcpy(dst + n, kError, size);
             }
-            *GetInstance().outputStream_ << "[" << LevelToString(level) << "] ";
+        }
+        n += static_cast<size_t>(size);
+        if (addNewline) {
+            if (n < cap) {
+                dst[n] = '\n';
+            }
+            ++n;
+        }
+        return n;
+    }
 
-            va_list args;
-            va_start(args, format);
+    static void AppendLine(std::string& out, LogLevel level, bool addNewline,
+                           std::chrono::system_clock::time_point now, const char* format, va_list args) {
+        size_t at = out.size();
+        out.resize(std::max(out.capacity(), at + 256));
+        size_t n = FormatLineTo(&out[at], out.size() - at, level, addNewline, now, format, args);
+        if (at + n >= out.size()) {
+            out.resize(at + n + 1);
+            FormatLineTo(&out[at], n + 1, level, addNewline, now, format, args);
+        }
+        out.resize(at + n);
+    }
+
+    // 把 [data, data + size) 完整写到输出 fd (调用方持有 mutex_)
+    void WriteOut(const char* data, size_t size) {
+        iovec iov{const_cast<char*>(data), size};
+        WriteOut(&iov, 1);
+    }
+
+    void WriteOut(iovec* iov, int count) {
+        if (rolling_) {
+            rolling_->Write(iov, count);
+            return;
+        }
+        if (outputFd_ == STDOUT_FILENO) {
+            std::cout.flush();  // 保持与用户 std::cout 输出的先后顺序
+        }
+        while (count > 0) {
+            ssize_t n = writev(outputFd_, iov, std::min(count, IOV_MAX));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            // 跳过已写完的 iovec, 处理部分写
+            while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+                n -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+
+    // 线程缓冲模式: 格式化到本线程缓冲区; 放不下时把缓冲区交给后台线程再换一个
+    void AppendBuffered(LogLevel level, bool addNewline, const char* format, va_list args) {
+        ThreadLines& tl = LocalLines();
+        auto now = Now();
+        std::lock_guard<std::mutex> lock(tl.lock);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (!tl.chunk.data) {
+                tl.chunk = AcquireChunk(kLineChunkSize);
+            }
+            LineChunk& c = tl.chunk;
+            size_t n = FormatLineTo(c.data.get() + c.size, c.capacity - c.size, level, addNewline, now,
+                                    format, args);
+            if (c.size + n < c.capacity) {
+                if (c.size == 0) {
+                    tl.sinceTick = tick_.load(std::memory_order_relaxed);
+                }
+                c.size += n;
+                return;
+            }
+            if (c.size == 0) {
+                // 超长的一行: 单独分配一块
+                LineChunk big = AcquireChunk(n + 1);
+                big.size = FormatLineTo(big.data.get(), big.capacity, level, addNewline, now, format, args);
+                HandOff(big);
+                return;
+            }
+            HandOff(c);
+        }
+    }
+
+    ThreadLines& LocalLines() {
+        thread_local ThreadLinesHolder holder;
+        if (!holder.lines) {
+            holder.lines = std::make_shared<ThreadLines>();
+            std::lock_guard<std::mutex> lock(linesMutex_);
+            threadLines_.push_back(holder.lines);
+        }
+        return *holder.lines;
+    }
+
+    LineChunk AcquireChunk(size_t capacity) {
+        if (capacity == kLineChunkSize) {
+            std::lock_guard<std::mutex> lock(handoffMutex_);
+            if (!freeChunks_.empty()) {
+                LineChunk c = std::move(freeChunks_.back());
+                freeChunks_.pop_back();
+                return c;
+            }
+        }
+        LineChunk c;
+        c.data.reset(new char[capacity]);
+        c.capacity = capacity;
+        return c;
+    }
+
+    // 把非空的缓冲区交给输出阶段 (调用方持有该缓冲区所属线程的 lock)
+    void HandOff(LineChunk& c) {
+        if (c.size == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(handoffMutex_);
+        fullChunks_.push_back(std::move(c));
+        ++handedOff_;
+        c = LineChunk();
+    }
+
+    // 交出所有线程缓冲区中的日志并等待写出
+    static void FlushLineBuffers() {
+        Logger& self = GetInstance();
+        self.StealLines(true);
+        size_t target;
+        {
+            std::lock_guard<std::mutex> lock(self.handoffMutex_);
+            target = self.handedOff_;
+        }
+        if (self.worker_.joinable()) {
+            while (self.chunksWritten_.load(std::memory_order_acquire) < target) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        } else {
+            self.WriteChunks();
+        }
+    }
+
+    // 取走超过延迟上限 (all 为 true 时取走全部) 的线程缓冲区, 回收已退出线程的记录
+    void StealLines(bool all) {
+        int64_t now = tick_.load(std::memory_order_relaxed);
+        int64_t limit = maxLatencyTicks_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(linesMutex_);
+        for (auto it = threadLines_.begin(); it != threadLines_.end();) {
+            ThreadLines& tl = **it;
+            bool orphaned;
+            {
+                std::lock_guard<std::mutex> lineLock(tl.lock);
+                if (tl.chunk.size > 0 && (all || now - tl.sinceTick >= limit)) {
+                    HandOff(tl.chunk);
+                }
+                orphaned = tl.orphaned;
+            }
+            if (orphaned) {
+                it = threadLines_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // 输出阶段: 一次 writev 写出所有已交出的缓冲区, 返回写出的块数
+    size_t WriteChunks() {
+        std::vector<LineChunk> chunks;
+        {
+            std::lock_guard<std::mutex> lock(handoffMutex_);
+            chunks.swap(fullChunks_);
+        }
+        if (chunks.empty()) {
+            return 0;
+        }
+        std::vector<iovec> iov(chunks.size());
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            iov[i].iov_base = chunks[i].data.get();
+            iov[i].iov_len = chunks[i].size;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            WriteOut(iov.data(), static_cast<int>(iov.size()));
+        }
+        {
+            std::lock_guard<std::mutex> lock(handoffMutex_);
+            for (LineChunk& c : chunks) {
+                if (c.capacity == kLineChunkSize && freeChunks_.size() < 64) {
+                    c.size = 0;
+                    freeChunks_.push_back(std::move(c));
+                }
+            }
+        }
+        chunksWritten_.fetch_add(chunks.size(), std::memory_order_release);
+        return chunks.size();
+    }
+
+    // 当前时间。内核 tick 精度够毫秒时用 CLOCK_REALTIME_COARSE, 见 util/timestamp.h
+    static std::chrono::system_clock::time_point Now() {
+        timespec ts;
+        clock_gettime(ts_clock(3), &ts);
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+    }
+
+    // 生成行前缀 "HH:MM:SS.mmm [LEVEL] " (时间戳关闭时只有等级), 返回 buf
+    static const char* FormatPrefix(char (&buf)[64], LogLevel level,
+                                    std::chrono::system_clock::time_point now) {
+        return FormatPrefix(buf, level, now, GetInstance().timestampEnabled_);
+    }
+
+    static const char* FormatPrefix(char (&buf)[64], LogLevel level,
+                                    std::chrono::system_clock::time_point now, bool timestamp) {
+        size_t n = 0;
+        if (timestamp) {
+            // "HH:MM:SS" 每秒只算一次, 见 util/timestamp.h
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+            timespec ts{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+            n = ts_format(buf, &ts, 3);
+            buf[n++] = ' ';
+        }
+        const char* name = LevelToString(level);
+        size_t len = strlen(name);
+        buf[n++] = '[';
+        memcpy(buf + n, name, len);
+        n += len;
+        memcpy(buf + n, "] ", 3);
+        return buf;
+    }
+
+    // 生产者: 在调用线程格式化消息, 放入队列。队列满时让出 CPU 等待后台线程腾出空间。
+    void PushAsync(LogLevel level, bool addNewline, const char* format, va_list args) {
+        auto fill = [&](AsyncRecord& r) {
+            r.level = level;
+            r.addNewline = addNewline;
+            r.time = Now();
             va_list args_copy;
             va_copy(args_copy, args);
-            int size = vsnprintf(nullptr, 0, format, args_copy);
+            int size = vsnprintf(r.text, sizeof(r.text), format, args_copy);
             va_end(args_copy);
+            if (size < 0) {
+                size = snprintf(r.text, sizeof(r.text), "Error formatting log message");
+            } else if (static_cast<size_t>(size) >= sizeof(r.text)) {
+                r.longText.resize(size + 1);
+                va_copy(args_copy, args);
+                vsnprintf(&r.longText[0], size + 1, format, args_copy);
+                va_end(args_copy);
+                r.longText.resize(size);
+            }
+            r.length = static_cast<size_t>(size);
+        };
+        while (!queue_->TryPush(fill)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // 按需启动/停止后台线程 (调用方持有 configMutex_)
+    void UpdateWorker() {
+        bool wanted = asyncEnabled_.load(std::memory_order_relaxed) ||
+                      deferredEnabled_.load(std::memory_order_relaxed) ||
+                      bufferedEnabled_.load(std::memory_order_relaxed);
+        if (wanted && !worker_.joinable()) {
+            stopWorker_.store(false, std::memory_order_relaxed);
+            worker_ = std::thread([this] { AsyncLoop(); });
+        } else if (!wanted) {
+            StopWorker();
+        }
+    }
 
-            if (size >= 0) {
-                std::vector<char> buffer(size + 1);
-                vsnprintf(buffer.data(), buffer.size(), format, args);
-                *GetInstance().outputStream_ << buffer.data();
+    // 后台线程: 读出各线程缓冲区中的延迟格式化记录, 格式化追加到 batch 或直接写二进制文件。
+    // 返回处理的条数。
+    size_t DrainRings(std::string& batch) {
+        size_t count = 0;
+        std::lock_guard<std::mutex> lock(ringsMutex_);
+        std::lock_guard<std::mutex> outLock(mutex_);
+        for (auto it = rings_.begin(); it != rings_.end();) {
+            detail::ByteRing& ring = **it;
+            bool orphaned = ring.Orphaned();  // 先读标记, 之后读到的 tail 一定是最终值
+            size_t head = ring.Head();
+            size_t tail = ring.Tail();
+            for (; head < tail; ++count) {
+                uint32_t size;
+                memcpy(&size, ring.At(head), sizeof(size));
+                if (size & kPaddingFlag) {
+                    head += size & ~kPaddingFlag;
+                    continue;
+                }
+                EmitDeferred(batch, ring.At(head));
+                head += size;
+            }
+            ring.Release(head);
+            if (orphaned) {
+                it = rings_.erase(it);
             } else {
-                *GetInstance().outputStream_ << "Error formatting log message";  // 格式化错误消息
+                ++it;
             }
-            va_end(args);
+        }
+        // 汇报因过大被丢弃的记录, 与普通记录一样写成文本或二进制
+        if (uint64_t dropped = deferredOversized_.exchange(0, std::memory_order_relaxed)) {
+            EmitReport(batch, LogLevel::Error, kOversizedFormat, static_cast<unsigned long long>(dropped),
+                       static_cast<unsigned long long>(kDeferredRingSize / 2));
+            ++count;
+        }
+        return count;
+    }
 
-            if (addNewline) {
-                *GetInstance().outputStream_ << "\n";
+    // 后台线程自己产生的一条日志: 编码成延迟格式化记录后交给 EmitDeferred, 因此和其他记录一样
+    // 写成文本或二进制, 也不会阻塞在自己负责清空的队列上。format 必须是静态存储。调用方持有 mutex_
+    template<typename... Args>
+    void EmitReport(std::string& batch, LogLevel level, const char* format, const Args&... args) {
+        size_t size = sizeof(DeferredHeader);
+        ((size += detail::ArgCodec<Args>::Size(args)), ...);
+        size = (size + 7) & ~size_t{7};
+        std::vector<uint8_t> record(size);
+        DeferredHeader h;
+        h.size = static_cast<uint32_t>(size);
+        h.level = static_cast<uint8_t>(level);
+        h.addNewline = true;
+        h.argCount = sizeof...(Args);
+        h.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       Now().time_since_epoch()).count();
+        h.format = reinterpret_cast<uintptr_t>(format);
+        memcpy(record.data(), &h, sizeof(h));
+        uint8_t* q = record.data() + sizeof(h);
+        ((q = detail::ArgCodec<Args>::Encode(q, args)), ...);
+        EmitDeferred(batch, record.data());
+    }
+
+    // 汇报各限流调用点尚未汇报的丢弃条数, 返回汇报的条数。调用方持有 mutex_
+    size_t ReportSuppressed(std::string& batch) {
+        size_t count = 0;
+        for (detail::LogSite* site = detail::LogSite::Sites().load(std::memory_order_acquire); site;
+             site = site->next) {
+            if (!IsEnabled(site->level)) {
+                continue;
+            }
+            if (uint64_t n = site->TakeSuppressed()) {
+                EmitReport(batch, site->level, kSuppressedFormat, site->file, site->line,
+                           static_cast<unsigned long long>(n));
+                ++count;
             }
-            GetInstance().outputStream_->flush();  // 确保立即写入
+        }
+        return count;
+    }
+
+    // 输出一条完整的延迟格式化记录 (记录头 + 参数), 调用方持有 mutex_
+    void EmitDeferred(std::string& batch, const uint8_t* record) {
+        DeferredHeader h;
+        memcpy(&h, record, sizeof(h));
+        const char* format = reinterpret_cast<const char*>(static_cast<uintptr_t>(h.format));
+        if (binaryFile_.is_open()) {
+            if (knownFormats_.insert(format).second) {
+                uint32_t len = static_cast<uint32_t>(strlen(format));
+                binaryFile_.put('F');
+                binaryFile_.write(reinterpret_cast<const char*>(&h.format), sizeof(h.format));
+                binaryFile_.write(reinterpret_cast<const char*>(&len), sizeof(len));
+                binaryFile_.write(format, len);
+            }
+            binaryFile_.put('M');
+            binaryFile_.write(reinterpret_cast<const char*>(record), h.size);
+        } else {
+            FormatDeferredRecord(batch, h, format, record + sizeof(h), timestampEnabled_);
+        }
+    }
+
+    // 后台线程: 取出一批日志拼接成一块, 一次写出。空闲时每 1ms 轮询一次, 每轮是一个 tick。
+    void AsyncLoop() {
+        std::string batch;
+        int64_t lastSiteReport = detail::MonotonicNs();
+        for (;;) {
+            size_t n = 0;
+            size_t deferred = DrainRings(batch);
+            // 限流调用点之后可能再也没有调用, 由这里定期汇报其丢弃条数
+            int64_t now = detail::MonotonicNs();
+            if (now - lastSiteReport >= detail::kSuppressReportNs) {
+                lastSiteReport = now;
+                std::lock_guard<std::mutex> lock(mutex_);
+                deferred += ReportSuppressed(batch);
+            }
+            tick_.fetch_add(1, std::memory_order_relaxed);
+            StealLines(false);
+            size_t chunks = WriteChunks();
+            while (queue_ && n < kAsyncBatch) {
+                AsyncRecord* r = queue_->Front();
+                if (!r) {
+                    break;
+                }
+                char prefix[64];
+                batch += FormatPrefix(prefix, r->level, r->time);
+                if (r->length < sizeof(r->text)) {
+                    batch.append(r->text, r->length);
+                } else {
+                    batch += r->longText;
+                    std::string().swap(r->longText);
+                }
+                if (r->addNewline) {
+                    batch += '\n';
+                }
+                queue_->Pop();
+                ++n;
+            }
+            if (!batch.empty()) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                WriteOut(batch.data(), batch.size());
+                batch.clear();
+            }
+            if (n > 0) {
+                consumed_.fetch_add(n, std::memory_order_release);
+            }
+            if (n > 0 || deferred > 0 || chunks > 0) {
+                continue;
+            }
+            if (stopWorker_.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // 通知后台线程写完剩余日志后退出
+    void StopWorker() {
+        if (worker_.joinable()) {
+            stopWorker_.store(true, std::memory_order_release);
+            worker_.join();
         }
     }
 
@@ -191,25 +1660,106 @@ private:
         }
     }
 
-    LogLevel currentLogLevel_;    // 当前日志等级
-    std::ostream* outputStream_;  // 输出流指针 (指向 cout 或文件流)
-    std::ofstream outputFile_;    // 文件输出流
+    std::atomic<LogLevel> currentLogLevel_;  // 当前日志等级
+    int outputFd_;                // 输出 fd (标准输出或日志文件)
+    std::unique_ptr<detail::RollingFile> rolling_;  // 滚动日志文件, 设置后优先于 outputFd_
     std::mutex mutex_;            // 互斥锁，用于线程安全
     bool timestampEnabled_;       // 是否启用时间戳
+
+    // 异步模式
+    std::mutex configMutex_;                                    // 串行化 SetAsync
+    std::atomic<bool> asyncEnabled_{false};                     // 是否启用异步模式
+    std::unique_ptr<detail::MpscQueue<AsyncRecord>> queue_;     // 生产者 -> 后台线程
+    std::thread worker_;                                        // 后台写线程
+    std::atomic<bool> stopWorker_{false};                       // 通知后台线程退出
+    std::atomic<size_t> consumed_{0};                           // 后台线程已写出的条数
+
+    // 延迟格式化模式
+    std::atomic<bool> deferredEnabled_{false};                  // 是否启用延迟格式化
+    std::mutex ringsMutex_;                                     // 保护 rings_
+    std::vector<std::shared_ptr<detail::ByteRing>> rings_;      // 各线程的缓冲区
+    std::ofstream binaryFile_;                                  // 二进制日志文件 (可选)
+    std::unordered_set<const char*> knownFormats_;              // 已写入二进制文件的格式串
+    std::atomic<uint64_t> deferredOversized_{0};                // 因过大被丢弃、尚未汇报的条数
+
+    // 线程缓冲模式
+    std::atomic<bool> bufferedEnabled_{false};                  // 是否启用线程缓冲
+    std::atomic<int64_t> maxLatencyTicks_{100};                 // 延迟上限 (tick, 约 1ms)
+    std::atomic<int64_t> tick_{0};                              // 后台线程轮询计数
+    std::mutex linesMutex_;                                     // 保护 threadLines_
+    std::vector<std::shared_ptr<ThreadLines>> threadLines_;     // 各线程的缓冲区
+    std::mutex handoffMutex_;                                   // 保护以下三项
+    std::vector<LineChunk> fullChunks_;                         // 待写出的缓冲区
+    std::vector<LineChunk> freeChunks_;                         // 可复用的缓冲区
+    size_t handedOff_ = 0;                                      // 累计交出的块数
+    std::atomic<size_t> chunksWritten_{0};                      // 累计写出的块数
 };
 
 } // namespace xlog
 
 //==============================================================================
+// 公共实现: 检查格式串; 等级在编译期或运行时不满足时不求值参数
+#define XLOG_CALL_(level, method, format, ...)                                           \
+    do {                                                                                 \
+        if (false) {                                                                     \
+            xlog::detail::CheckFormat(format, ##__VA_ARGS__);                            \
+        }                                                                                \
+        if (static_cast<int>(level) >= XLOG_MIN_LEVEL && xlog::Logger::IsEnabled(level)) { \
+            xlog::Logger::method(format, ##__VA_ARGS__);                                 \
+        }                                                                                \
+    } while (0)
+
 // log with newline
-#define XLOG_ERROR(format, ...) xlog::Logger::Error(format, ##__VA_ARGS__)
-#define XLOG_INFO(format, ...) xlog::Logger::Info(format, ##__VA_ARGS__)
-#define XLOG_DEBUG(format, ...) xlog::Logger::Debug(format, ##__VA_ARGS__)
+#define XLOG_ERROR(format, ...) XLOG_CALL_(xlog::LogLevel::Error, Error, format, ##__VA_ARGS__)
+#define XLOG_INFO(format, ...) XLOG_CALL_(xlog::LogLevel::Info, Info, format, ##__VA_ARGS__)
+#define XLOG_DEBUG(format, ...) XLOG_CALL_(xlog::LogLevel::Debug, Debug, format, ##__VA_ARGS__)
 // log raw
-#define XLOG_ERROR_RAW(format, ...) xlog::Logger::ErrorRaw(format, ##__VA_ARGS__)
-#define XLOG_INFO_RAW(format, ...) xlog::Logger::InfoRaw(format, ##__VA_ARGS__)
-#define XLOG_DEBUG_RAW(format, ...) xlog::Logger::DebugRaw(format, ##__VA_ARGS__)
+#define XLOG_ERROR_RAW(format, ...) XLOG_CALL_(xlog::LogLevel::Error, ErrorRaw, format, ##__VA_ARGS__)
+#define XLOG_INFO_RAW(format, ...) XLOG_CALL_(xlog::LogLevel::Info, InfoRaw, format, ##__VA_ARGS__)
+#define XLOG_DEBUG_RAW(format, ...) XLOG_CALL_(xlog::LogLevel::Debug, DebugRaw, format, ##__VA_ARGS__)
+// 限流: 每个调用点独立计数, 被丢弃的条数在该调用点下一次输出前汇报; 一直被丢弃时每 10 秒
+// 左右汇报一次, 另见 Logger::ReportSuppressed
+#define XLOG_SITE_CALL_(level, method, admit, format, ...)                               \
+    do {                                                                                 \
+        if (false) {                                                                     \
+            xlog::detail::CheckFormat(format, ##__VA_ARGS__);                            \
+        }                                                                                \
+        if (static_cast<int>(level) >= XLOG_MIN_LEVEL && xlog::Logger::IsEnabled(level)) { \
+            static xlog::detail::LogSite xlogSite_;                                      \
+            uint64_t xlogSuppressed_;                                                    \
+            if (xlogSite_.admit) {                                                       \
+                if ((xlogSuppressed_ = xlogSite_.TakeSuppressed()) != 0) {               \
+                    xlog::Logger::method(xlog::Logger::kSuppressedFormat, __FILE__, __LINE__, \
+                                         static_cast<unsigned long long>(xlogSuppressed_)); \
+                }                                                                        \
+                xlog::Logger::method(format, ##__VA_ARGS__);                             \
+            } else if ((xlogSuppressed_ = xlogSite_.Suppress(__FILE__, __LINE__, level)) != 0) { \
+                xlog::Logger::method(xlog::Logger::kSuppressedFormat, __FILE__, __LINE__, \
+                                     static_cast<unsigned long long>(xlogSuppressed_));  \
+            }                                                                            \
+        }                                                                                \
+    } while (0)
+
+// 每 n 次调用输出一次 (第 1, n+1, 2n+1, ... 次)
+#define XLOG_ERROR_EVERY_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Error, Error, EveryN(n), format, ##__VA_ARGS__)
+#define XLOG_INFO_EVERY_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Info, Info, EveryN(n), format, ##__VA_ARGS__)
+#define XLOG_DEBUG_EVERY_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Debug, Debug, EveryN(n), format, ##__VA_ARGS__)
+// 只输出前 n 次
+#define XLOG_ERROR_FIRST_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Error, Error, FirstN(n), format, ##__VA_ARGS__)
+#define XLOG_INFO_FIRST_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Info, Info, FirstN(n), format, ##__VA_ARGS__)
+#define XLOG_DEBUG_FIRST_N(n, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Debug, Debug, FirstN(n), format, ##__VA_ARGS__)
+// 令牌桶限流: 平均每秒最多 perSecond 条, 允许 1 秒的突发
+#define XLOG_ERROR_RATE(perSecond, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Error, Error, Rate(perSecond), format, ##__VA_ARGS__)
+#define XLOG_INFO_RATE(perSecond, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Info, Info, Rate(perSecond), format, ##__VA_ARGS__)
+#define XLOG_DEBUG_RATE(perSecond, format, ...) XLOG_SITE_CALL_(xlog::LogLevel::Debug, Debug, Rate(perSecond), format, ##__VA_ARGS__)
 // config
 #define XLOG_SET_LEVEL(level) xlog::Logger::SetLogLevel(level)
 #define XLOG_SET_FILE(filename) xlog::Logger::SetOutputToFile(filename)
-#define XLOG_ENABLE_TIMESTAMP(enable) xlog::Logger::EnableTimestamp(enable)
\ No newline at end of file
+#define XLOG_ENABLE_TIMESTAMP(enable) xlog::Logger::EnableTimestamp(enable)
+#define XLOG_ENABLE_ASYNC(enable) xlog::Logger::SetAsync(enable)
+#define XLOG_FLUSH() xlog::Logger::Flush()
+#define XLOG_ENABLE_DEFERRED(enable) xlog::Logger::SetDeferred(enable)
+#define XLOG_SET_BINARY_FILE(filename) xlog::Logger::SetBinaryOutput(filename)
+#define XLOG_ENABLE_BUFFERED(enable) xlog::Logger::SetBuffered(enable)
+#define XLOG_SET_ROLLING_FILE(base, maxBytes, maxSeconds, maxFiles) \
+    xlog::Logger::SetRollingFile(base, maxBytes, std::chrono::seconds(maxSeconds), maxFiles)
@@ -1,34 +1,693 @@
 #pragma once
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "timestamp.h"
+
+/*
+ * C 日志, 用法与 printf 相同: log("fd %d", fd); log_error(...); log_info(...); log_debug(...);
+ * 输出格式: [时间][文件:行号] 日志信息
+ *
+ * 调用线程只把时间、格式串指针和参数拷贝进本线程的环形缓冲区, 由后台 flusher 线程格式化,
+ * 攒成一批后一次 write 到标准输出 (fd 1)。
+ *
+ * - 入队不加锁、不分配内存、不调用 stdio, 只用原子操作和 memcpy。
+ *   缓冲区来自预分配的池子, 线程第一次写日志时用 CAS 认领一个, 并用 pthread_setspecific
+ *   登记退出时归还; 池子用完时各线程共用一个多生产者的缓冲区。
+ * - 信号处理函数里可以调用, 前提是被打断的线程已经在普通上下文里写过日志或调用过
+ *   log_thread_init(): 第一次调用里的 pthread_setspecific 不是异步信号安全的。
+ * - 缓冲区满时让出 CPU 等待 flusher, 超过 LOG_FULL_WAIT_MS 仍没有空位则丢弃并计数,
+ *   由 flusher 输出丢弃条数。信号处理函数打断的线程正持有 flusher 需要的锁 (log_flush) 时,
+ *   也最多等这么久。
+ * - 编译期等级 LOG_LEVEL (默认 LOG_LEVEL_DEBUG), 低于它的调用连同参数求值一起被编译掉。
+ *   log() 等同 log_info()。
+ * - 进程正常退出 (exit 或 main 返回) 时写完剩余日志。log_flush() 可主动等待写出,
+ *   不能在信号处理函数里调用。
+ * - 格式串必须是字符串字面量。参数按转换说明拷贝: 字符串截断到单条记录放得下的长度,
+ *   long double 按 double 保存, %n 被忽略, %m 使用调用时的 errno。
+ * - 同一线程的日志保持顺序, 不同线程之间不保证; 与程序自己的 printf 输出之间也不保证顺序。
+ * - 可以 fork: fork 前先写出已提交的日志, 子进程丢弃从父进程继承的其余记录 (由父进程输出),
+ *   并启动自己的 flusher。
+ * - 需要链接 pthread。状态用弱符号定义, 多个源文件包含本头文件时共用一份。
+ */
 
 /* 日志开关, 关闭打印只把宏需改为0即可 */
+#ifndef LOG_SWITCH
 #define LOG_SWITCH 1
+#endif
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_OFF 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 256 /* 每个线程的记录数, 2 的幂 */
+#endif
+/*
+ * 池子里的缓冲区数, 第 0 个是共用的。池子是 BSS 里的静态数组, 约 LOG_MAX_THREADS *
+ * LOG_RING_SLOTS * 512 字节, 默认 8MB, 每个包含本头文件的可执行文件或共享库各一份;
+ * 只有写过日志的缓冲区的页才真正占用物理内存。内存紧张时调小这两个值。
+ */
+#ifndef LOG_MAX_THREADS
+#define LOG_MAX_THREADS 64
+#endif
+#ifndef LOG_FULL_WAIT_MS
+#define LOG_FULL_WAIT_MS 50 /* 缓冲区满时最多等待的时间 */
+#endif
+#define LOG_REC_ARGS 464   /* 单条记录的参数区, 记录共 512 字节 */
+#define LOG_LINE_MAX 1024  /* 格式化后单行最大长度, 超出截断 */
+#define LOG_OUT_SIZE 65536 /* flusher 每次 write 的最大字节数 */
+
+/* 一条日志。seq 是槽位状态, 相对本圈起点 (pos & ~mask): 0 空闲, 1 已写好, mask + 1 已读走 */
+struct log_rec {
+    unsigned long seq;
+    const char *fmt;
+    const char *file;
+    long long ns; /* CLOCK_REALTIME 纳秒 */
+    int line;
+    int err; /* 调用时的 errno, 用于 %m */
+    unsigned int size;
+    unsigned char args[LOG_REC_ARGS];
+};
+
+/* 多生产者 (本线程和打断它的信号处理函数) 单消费者 (flusher) 的环形缓冲区 */
+struct log_ring {
+    struct log_rec recs[LOG_RING_SLOTS];
+    unsigned long tail; /* 生产者认领的位置 */
+    unsigned long head; /* flusher 读到的位置, 生产者只用来判断是否过半 */
+    int state;          /* 0 空闲, 1 使用中, 2 所属线程已退出 */
+};
 
-/* 获取时间戳，使用static inline，方便日志API可以被放到头文件中 */
+struct log_state {
+    pthread_key_t key;    /* 线程退出时归还缓冲区 */
+    pthread_t flusher;
+    int started;
+    int stop;
+    int sleeping;          /* flusher 正在等待 wake */
+    unsigned int wake;     /* futex: 生产者加一并唤醒 flusher */
+    unsigned long dropped;       /* 上次汇报以来丢弃的条数 */
+    unsigned long dropped_total; /* 累计丢弃的条数 */
+    size_t out_len;
+    char out[LOG_OUT_SIZE];
+    struct log_ring rings[LOG_MAX_THREADS];
+};
+
+__attribute__((weak)) struct log_state log_state_;
+/* flusher 和 log_flush 之间互斥, 保护各缓冲区的 head 和 log_state_.out */
+__attribute__((weak)) pthread_mutex_t log_lock_ = PTHREAD_MUTEX_INITIALIZER;
+__attribute__((weak)) __thread struct log_ring *log_ring_;
+
+/* 获取时间戳，使用static inline，方便日志API可以被放到头文件中。日期时间部分每秒只算一次, 见 timestamp.h */
 static inline void log_time()
 {
-    char buffer[26];
-    struct tm *tm_info;
-    struct timeval tv;
+    char buffer[TS_BUF_SIZE];
+
+    ts_now_format(buffer, 6);
+    printf("[%s]", buffer);
+}
+
+/* 本线程的缓冲区, 没有时从池子认领 (CAS) 并登记退出时归还。已认领后只读 __thread 变量 */
+static inline struct log_ring *log_thread_ring(void)
+{
+    struct log_state *s = &log_state_;
+    int i;
 
-    gettimeofday(&tv, NULL);
-    //int millisec = tv.tv_usec / 1000;
-    int microseconds =  tv.tv_usec % (1000 * 1000);
-    tm_info = localtime(&tv.tv_sec);
+    if (log_ring_)
+        return log_ring_;
+    for (i = 1; i < LOG_MAX_THREADS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&s->rings[i].state, &expected, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            if (__atomic_load_n(&s->started, __ATOMIC_ACQUIRE) > 0)
+                pthread_setspecific(s->key, &s->rings[i]);
+            log_ring_ = &s->rings[i];
+            return log_ring_;
+        }
+    }
+    return &s->rings[0];
+}
+
+/* 预先认领本线程的缓冲区, 之后本线程的信号处理函数里可以写日志。不能在信号处理函数里调用 */
+static inline void log_thread_init(void)
+{
+    (void)log_thread_ring();
+}
+
+/* 唤醒 flusher, 只用 futex 系统调用, 信号处理函数里也可以调用 */
+static inline void log_wake(void)
+{
+    if (__atomic_load_n(&log_state_.sleeping, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&log_state_.wake, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &log_state_.wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* 追加 8 字节的参数值, 放不下时返回 0, 之后的参数都输出为 <?> */
+static inline int log_put(unsigned char *args, unsigned int *n, const void *v)
+{
+    if (*n + 8 > LOG_REC_ARGS)
+        return 0;
+    memcpy(args + *n, v, 8);
+    *n += 8;
+    return 1;
+}
+
+/* 跳过 flags/宽度/精度/长度修饰, 返回转换字符的位置; 宽度或精度为 '*' 时计数 */
+static inline const char *log_spec(const char *p, int *stars, int *length)
+{
+    *stars = 0;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' || *p == '\'')
+        p++;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    /* 长度修饰: 'h' 'H'(hh) 'l' 'q'(ll) 'j' 'z' 't' 'L' */
+    *length = 0;
+    if (p[0] == 'h' && p[1] == 'h') {
+        *length = 'H';
+        p += 2;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        *length = 'q';
+        p += 2;
+    } else if (*p == 'h' || *p == 'l' || *p == 'q' || *p == 'j' || *p == 'z' || *p == 't' ||
+               *p == 'L') {
+        *length = *p++;
+    }
+    return p;
+}
+
+/* 按转换说明从 ap 取出参数: 整数按长度修饰截断后存 8 字节, 浮点存 double, 字符串存 2 字节长度 + 内容 */
+static inline unsigned int log_capture(unsigned char *args, const char *fmt, va_list ap)
+{
+    unsigned int n = 0;
+    const char *p = fmt;
+    int ok = 1;
+
+    while (*p && ok) {
+        int stars, length;
+        long long i;
+        unsigned long long u;
+        double d;
+
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        p = log_spec(p, &stars, &length);
+        while (stars-- > 0 && ok) {
+            i = va_arg(ap, int);
+            ok = log_put(args, &n, &i);
+        }
+        if (!ok)
+            break;
+        switch (*p) {
+        case 'd':
+        case 'i':
+            switch (length) {
+            case 'H': i = (signed char)va_arg(ap, int); break;
+            case 'h': i = (short)va_arg(ap, int); break;
+            case 'l': i = va_arg(ap, long); break;
+            case 'q': i = va_arg(ap, long long); break;
+            case 'j': i = va_arg(ap, intmax_t); break;
+            case 'z': i = va_arg(ap, ssize_t); break;
+            case 't': i = va_arg(ap, ptrdiff_t); break;
+            default: i = va_arg(ap, int); break;
+            }
+            ok = log_put(args, &n, &i);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (length) {
+            case 'H': u = (unsigned char)va_arg(ap, unsigned int); break;
+            case 'h': u = (unsigned short)va_arg(ap, unsigned int); break;
+            case 'l': u = va_arg(ap, unsigned long); break;
+            case 'q': u = va_arg(ap, unsigned long long); break;
+            case 'j': u = va_arg(ap, uintmax_t); break;
+            case 'z': u = va_arg(ap, size_t); break;
+            case 't': u = (unsigned long long)va_arg(ap, ptrdiff_t); break;
+            default: u = va_arg(ap, unsigned int); break;
+            }
+            ok = log_put(args, &n, &u);
+            break;
+        case 'c':
+            i = va_arg(ap, int);
+            ok = log_put(args, &n, &i);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            d = length == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+            ok = log_put(args, &n, &d);
+            break;
+        case 's': {
+            const char *str = va_arg(ap, const char *);
+            size_t len, room;
+
+            if (!str)
+                str = "(null)";
+            if (n + 2 > LOG_REC_ARGS) {
+                ok = 0;
+                break;
+            }
+            room = LOG_REC_ARGS - n - 2;
+            len = strnlen(str, room);
+            args[n] = (unsigned char)len;
+            args[n + 1] = (unsigned char)(len >> 8);
+            memcpy(args + n + 2, str, len);
+            n += 2 + (unsigned int)len;
+            break;
+        }
+        case 'p':
+        case 'n':
+            u = (uintptr_t)va_arg(ap, void *);
+            if (*p == 'p')
+                ok = log_put(args, &n, &u);
+            break;
+        default: /* %m 等不取参数 */
+            break;
+        }
+        if (*p)
+            p++;
+    }
+    return n;
+}
+
+static inline void log_write(const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static inline void log_write(const char *file, int line, const char *fmt, ...)
+{
+    int err = errno;
+    struct log_ring *ring = log_thread_ring();
+    unsigned long mask = LOG_RING_SLOTS - 1;
+    unsigned long pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct log_rec *rec;
+    struct timespec ts;
+    long long wait_ms = 0;
+    va_list ap;
+
+    for (;;) {
+        long diff;
+
+        rec = &ring->recs[pos & mask];
+        diff = (long)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - (pos & ~mask));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* 上一圈的记录还没被读走: 满了, 让出 CPU 等 flusher, 等太久就丢弃 */
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            if (!wait_ms)
+                wait_ms = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+            else if (ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - wait_ms > LOG_FULL_WAIT_MS) {
+                __atomic_fetch_add(&log_state_.dropped, 1, __ATOMIC_RELAXED);
+                errno = err;
+                return;
+            }
+            log_wake();
+            sched_yield();
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+    clock_gettime(ts_clock(6), &ts);
+    rec->fmt = fmt;
+    rec->file = file;
+    rec->line = line;
+    rec->err = err;
+    rec->ns = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    va_start(ap, fmt);
+    rec->size = log_capture(rec->args, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&rec->seq, (pos & ~mask) + 1, __ATOMIC_RELEASE);
+    /* 写到一半时叫醒 flusher, 不等它睡满一个周期 */
+    if (pos - __atomic_load_n(&ring->head, __ATOMIC_RELAXED) == LOG_RING_SLOTS / 2)
+        log_wake();
+    errno = err;
+}
+
+/* 取出 8 字节的参数值, 没有时返回 0 */
+static inline int log_get(const unsigned char **args, const unsigned char *end, void *v)
+{
+    if (*args + 8 > end)
+        return 0;
+    memcpy(v, *args, 8);
+    *args += 8;
+    return 1;
+}
+
+/* 按格式串解码参数写入 buf (最多 cap - 1 个字符), 返回长度。逐个转换说明调用 snprintf:
+ * 整数在入队时已按长度修饰截断, 这里统一换成 ll; '*' 换成入队时取到的值。结果与直接 printf 一致 */
+static inline size_t log_format(char *buf, size_t cap, const struct log_rec *rec)
+{
+    const unsigned char *args = rec->args;
+    const unsigned char *end = rec->args + rec->size;
+    const char *p = rec->fmt;
+    size_t n = 0;
+
+    while (*p && n + 1 < cap) {
+        char spec[64];
+        char str[LOG_REC_ARGS + 1];
+        const char *start = p, *conv, *q;
+        int stars, length, len = 0, ok = 1, w;
+        long long i;
+        double d;
+
+        if (*p != '%' || p[1] == '%') {
+            buf[n++] = *p;
+            p += *p == '%' ? 2 : 1;
+            continue;
+        }
+        conv = log_spec(p + 1, &stars, &length);
+        if (!*conv)
+            break;
+        /* 拷贝 '%'、flags、宽度、精度, 去掉长度修饰 */
+        for (q = p; q < conv - (length == 'H' || length == 'q' ? 2 : length ? 1 : 0); q++) {
+            if (len > (int)sizeof(spec) - 16)
+                break;
+            if (*q != '*')
+                spec[len++] = *q;
+            else if (ok && (ok = log_get(&args, end, &i)))
+                len += snprintf(spec + len, 12, "%d", (int)i);
+        }
+        if (strchr("diouxX", *conv)) {
+            spec[len++] = 'l';
+            spec[len++] = 'l';
+        }
+        spec[len++] = *conv;
+        spec[len] = '\0';
+        p = conv + 1;
+
+        w = 0;
+        switch (*conv) {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            if (ok && (ok = log_get(&args, end, &i)))
+                w = *conv == 'c' ? snprintf(buf + n, cap - n, spec, (int)i)
+                                 : snprintf(buf + n, cap - n, spec, i);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (ok && (ok = log_get(&args, end, &d)))
+                w = snprintf(buf + n, cap - n, spec, d);
+            break;
+        case 's':
+            if (ok && (ok = args + 2 <= end)) {
+                size_t slen = args[0] | (size_t)args[1] << 8;
+                memcpy(str, args + 2, slen);
+                str[slen] = '\0';
+                args += 2 + slen;
+                w = snprintf(buf + n, cap - n, spec, str);
+            }
+            break;
+        case 'p':
+            if (ok && (ok = log_get(&args, end, &i)))
+                w = snprintf(buf + n, cap - n, spec, (void *)(uintptr_t)i);
+            break;
+        case 'm':
+            w = snprintf(buf + n, cap - n, "%s", strerror(rec->err));
+            break;
+        case 'n':
+            break;
+        default: /* 不认识的转换说明原样输出 */
+            w = snprintf(buf + n, cap - n, "%.*s", (int)(p - start), start);
+            break;
+        }
+        if (!ok)
+            w = snprintf(buf + n, cap - n, "<?>");
+        if (w > 0)
+            n += (size_t)w < cap - n ? (size_t)w : cap - n - 1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* 一条记录格式化为 "[时间][文件:行号] 日志信息\n", 返回长度 */
+static inline size_t log_format_line(char *line, const struct log_rec *rec)
+{
+    char time_buf[TS_BUF_SIZE];
+    struct timespec ts = {(time_t)(rec->ns / 1000000000), (long)(rec->ns % 1000000000)};
+    int n;
+
+    ts_format(time_buf, &ts, 6);
+    n = snprintf(line, LOG_LINE_MAX, "[%s][%s:%d] ", time_buf, rec->file, rec->line);
+    if (n > LOG_LINE_MAX / 2)
+        n = LOG_LINE_MAX / 2;
+    n += (int)log_format(line + n, LOG_LINE_MAX - 1 - n, rec);
+    line[n++] = '\n';
+    return (size_t)n;
+}
+
+static inline void log_out_flush(struct log_state *s)
+{
+    size_t off = 0;
+
+    while (off < s->out_len) {
+        ssize_t w = write(STDOUT_FILENO, s->out + off, s->out_len - off);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            break;
+        off += (size_t)w;
+    }
+    s->out_len = 0;
+}
+
+static inline void log_out(struct log_state *s, const char *p, size_t len)
+{
+    if (s->out_len + len > LOG_OUT_SIZE)
+        log_out_flush(s);
+    memcpy(s->out + s->out_len, p, len);
+    s->out_len += len;
+}
+
+/* 读走所有缓冲区里已写好的记录并写出, 返回条数。调用方持有 log_lock_ */
+static inline unsigned long log_drain_locked(struct log_state *s)
+{
+    char line[LOG_LINE_MAX];
+    unsigned long mask = LOG_RING_SLOTS - 1;
+    unsigned long count = 0, dropped;
+    int i;
+
+    for (i = 0; i < LOG_MAX_THREADS; i++) {
+        struct log_ring *r = &s->rings[i];
+        int state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+
+        if (state == 0 && i != 0)
+            continue;
+        for (;;) {
+            struct log_rec *rec = &r->recs[r->head & mask];
+
+            if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != (r->head & ~mask) + 1)
+                break;
+            log_out(s, line, log_format_line(line, rec));
+            __atomic_store_n(&rec->seq, (r->head & ~mask) + mask + 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELAXED);
+            count++;
+        }
+        /* 所属线程已退出且记录都已读走: 归还给池子 */
+        if (state == 2 && r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+            __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+    }
+    dropped = __atomic_exchange_n(&s->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        char time_buf[TS_BUF_SIZE];
+        int n;
+
+        __atomic_fetch_add(&s->dropped_total, dropped, __ATOMIC_RELAXED);
+        ts_now_format(time_buf, 6);
+        n = snprintf(line, sizeof(line), "[%s][log] dropped %lu messages\n", time_buf, dropped);
+        log_out(s, line, (size_t)n);
+    }
+    log_out_flush(s);
+    return count;
+}
+
+/* 等待已写入的日志全部输出。不能在信号处理函数里调用 */
+static inline void log_flush(void)
+{
+    pthread_mutex_lock(&log_lock_);
+    log_drain_locked(&log_state_);
+    pthread_mutex_unlock(&log_lock_);
+}
+
+static inline void log_thread_exit(void *ring)
+{
+    __atomic_store_n(&((struct log_ring *)ring)->state, 2, __ATOMIC_RELEASE);
+}
+
+/* 有日志时连续读, 没有时睡 1ms, 一直空闲则逐步放慢到 16ms; 生产者缓冲区过半或满时唤醒 */
+static inline void *log_flusher(void *arg)
+{
+    struct log_state *s = (struct log_state *)arg;
+    struct timespec tick = {0, 1000000};
+    unsigned int wake;
+
+    for (;;) {
+        int stop = __atomic_load_n(&s->stop, __ATOMIC_ACQUIRE);
+        unsigned long n;
+
+        pthread_mutex_lock(&log_lock_);
+        n = log_drain_locked(s);
+        pthread_mutex_unlock(&log_lock_);
+        if (stop)
+            break;
+        if (n) {
+            tick.tv_nsec = 1000000;
+            continue;
+        }
+        wake = __atomic_load_n(&s->wake, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&s->sleeping, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &s->wake, FUTEX_WAIT_PRIVATE, wake, &tick, NULL, 0);
+        __atomic_store_n(&s->sleeping, 0, __ATOMIC_RELAXED);
+        if (tick.tv_nsec < 16000000)
+            tick.tv_nsec *= 2;
+    }
+    return NULL;
+}
+
+static inline void log_atexit(void)
+{
+    struct log_state *s = &log_state_;
+
+    if (s->started == 1) {
+        __atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(s->flusher, NULL);
+    }
+    log_flush();
+}
+
+/* 创建 flusher, 返回 started 的新值: 1 flusher 运行中, 2 创建失败 */
+static inline int log_start_flusher(struct log_state *s)
+{
+    sigset_t all, old;
+    int ret;
+
+    /* flusher 屏蔽所有信号, 进程收到的信号只投递给业务线程 */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    ret = pthread_create(&s->flusher, NULL, log_flusher, s) == 0 ? 1 : 2;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ret;
+}
+
+/* fork 前写出已提交的日志, 并持有 log_lock_ 直到 fork 返回, 子进程拿到的缓冲区不会读到一半 */
+static inline void log_atfork_prepare(void)
+{
+    pthread_mutex_lock(&log_lock_);
+    log_drain_locked(&log_state_);
+}
+
+static inline void log_atfork_parent(void)
+{
+    pthread_mutex_unlock(&log_lock_);
+}
+
+/*
+ * 子进程里只剩调用 fork 的线程, 原来的 flusher 不存在了。prepare 之后别的线程写入的记录
+ * 由父进程输出, 这里标记为已读走; 别的线程认领的缓冲区归还给池子。只处理用过的缓冲区,
+ * 不碰其余的页, 避免写时复制。最后启动子进程自己的 flusher。
+ */
+static inline void log_atfork_child(void)
+{
+    struct log_state *s = &log_state_;
+    unsigned long mask = LOG_RING_SLOTS - 1;
+    int i;
+
+    for (i = 0; i < LOG_MAX_THREADS; i++) {
+        struct log_ring *r = &s->rings[i];
+
+        if (r->state == 0 && r->head == r->tail)
+            continue;
+        for (; r->head != r->tail; r->head++)
+            r->recs[r->head & mask].seq = (r->head & ~mask) + mask + 1;
+        if (r != log_ring_)
+            r->state = 0;
+    }
+    s->dropped = 0;
+    s->sleeping = 0;
+    pthread_mutex_unlock(&log_lock_);
+    if (s->started == 1)
+        __atomic_store_n(&s->started, log_start_flusher(s), __ATOMIC_RELEASE);
+}
+
+/* 程序启动时创建 flusher (多个源文件包含时只创建一次)。started: 1 flusher 运行中, 2 创建失败 */
+__attribute__((constructor, used)) static inline void log_start(void)
+{
+    struct log_state *s = &log_state_;
+    int expected = 0;
 
-    strftime(buffer, 26, "[%H:%M:%S", tm_info);
-    printf("%s.%06d]", buffer, microseconds);
+    if (!__atomic_compare_exchange_n(&s->started, &expected, -1, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED))
+        return;
+    pthread_key_create(&s->key, log_thread_exit);
+    pthread_atfork(log_atfork_prepare, log_atfork_parent, log_atfork_child);
+    expected = log_start_flusher(s);
+    atexit(log_atexit);
+    __atomic_store_n(&s->started, expected, __ATOMIC_RELEASE);
 }
 
-/* 格式：时间 模块 文件:行号 @@ 函数 日志信息 */
-#define log(fmt, ...) do { \
-    if (LOG_SWITCH) { \
-        log_time(); \
-        printf("[%s:%d] " fmt "\n", \
-                __FILE__, __LINE__, ##__VA_ARGS__); \
-    } \
+/* 编译期等级不满足时整条调用被编译掉, 格式串仍按 printf 规则检查 */
+#define LOG_CALL_(level, fmt, ...) do { \
+    if (LOG_SWITCH && (level) >= LOG_LEVEL) \
+        log_write(__FILE__, __LINE__, fmt, ##__VA_ARGS__); \
 } while (0)
 
+/* 格式：[时间][文件:行号] 日志信息 */
+#define log(fmt, ...) LOG_CALL_(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define log_debug(fmt, ...) LOG_CALL_(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...) LOG_CALL_(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define log_error(fmt, ...) LOG_CALL_(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
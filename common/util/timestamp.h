@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * 日志时间戳 "HH:MM:SS.ffffff", C/C++ 通用, 线程安全。
+ *
+ * localtime_r + strftime 每条日志都算一遍很贵, 这里把 "HH:MM:SS" 缓存在线程局部变量里,
+ * 秒数变化时才重算, 每次调用只填写小数部分的数字。
+ *
+ * 时钟: 内核 tick 精度足够时 (CLOCK_REALTIME_COARSE 的分辨率不大于所需小数位) 用 COARSE,
+ * 只读 vDSO 里的变量, 否则用 CLOCK_REALTIME。
+ */
+
+#define TS_BUF_SIZE 20 /* "HH:MM:SS." + 9 位小数 + '\0' */
+
+struct ts_cache {
+    time_t sec;
+    char hms[9];
+};
+
+static __thread struct ts_cache ts_cache_ = {-1, {0}};
+
+/* 按需要的小数位数 (0-9) 选择时钟 */
+static inline clockid_t ts_clock(int digits)
+{
+    static long coarse_res = -1; /* 纳秒, 首次调用时查询 */
+    long res = __atomic_load_n(&coarse_res, __ATOMIC_RELAXED);
+    long need = 1;
+    int i;
+
+    if (res < 0) {
+        struct timespec r;
+        res = clock_getres(CLOCK_REALTIME_COARSE, &r) == 0 && r.tv_sec == 0 ? r.tv_nsec : 1000000000L;
+        __atomic_store_n(&coarse_res, res, __ATOMIC_RELAXED);
+    }
+    for (i = digits; i < 9; i++)
+        need *= 10;
+    return res <= need ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+}
+
+/* 把 ts 格式化为 "HH:MM:SS[.f...]" 写入 buf (至少 TS_BUF_SIZE 字节), 返回长度 */
+static inline int ts_format(char *buf, const struct timespec *ts, int digits)
+{
+    struct ts_cache *c = &ts_cache_;
+    long frac = ts->tv_nsec;
+    int i;
+
+    if (ts->tv_sec != c->sec) {
+        struct tm tm_info;
+        localtime_r(&ts->tv_sec, &tm_info);
+        strftime(c->hms, sizeof(c->hms), "%H:%M:%S", &tm_info);
+        c->sec = ts->tv_sec;
+    }
+    memcpy(buf, c->hms, 8);
+    if (digits <= 0) {
+        buf[8] = '\0';
+        return 8;
+    }
+    if (digits > 9)
+        digits = 9;
+    for (i = digits; i < 9; i++)
+        frac /= 10;
+    buf[8] = '.';
+    for (i = digits; i > 0; i--) {
+        buf[8 + i] = (char)('0' + frac % 10);
+        frac /= 10;
+    }
+    buf[9 + digits] = '\0';
+    return 9 + digits;
+}
+
+/* 取当前时间并格式化, 返回长度 */
+static inline int ts_now_format(char *buf, int digits)
+{
+    struct timespec ts;
+
+    clock_gettime(ts_clock(digits), &ts);
+    return ts_format(buf, &ts, digits);
+}